@@ -3,7 +3,7 @@
     {
         "target_name": "realsense",
         "sources": [],
-        "defines": [],
+        "defines": [ "NAPI_VERSION=8" ],
         "cflags": ["-std=c++11", "-Wall", "-pedantic", "-O3"],
         "include_dirs": [ 
           "<!(node -p \"require('node-addon-api').include_dir\")",
@@ -0,0 +1,105 @@
+#ifndef REALSENSE_BUFFERPOOL_H
+#define REALSENSE_BUFFERPOOL_H
+
+/*
+	A pool of aligned native memory blocks, for the frame buffers that are handed to JS as external ArrayBuffers.
+
+	Blocks are returned to the pool when JS garbage-collects the array that wraps them, and are reused for the
+	next array of the same size, so that steady-state capture does no heap allocation. Each block records its
+	own size in a header just before the aligned data, so release() only needs the data pointer.
+	acquire() and release() may be called from any thread.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <mutex>
+#include <vector>
+
+class BufferPool {
+public:
+
+	// enough for AVX loads & stores, and keeps rows apart on separate cache lines
+	static const size_t ALIGNMENT = 64;
+
+	// free blocks kept per size, beyond which released blocks are freed
+	size_t max_free_per_size = 8;
+
+	~BufferPool() {
+		for (auto& kv : free_blocks) {
+			for (void * data : kv.second) free_block(data);
+		}
+	}
+
+	// a block of at least `bytes` bytes, aligned to ALIGNMENT
+	// newly allocated blocks are zeroed; reused blocks hold whatever was last written to them
+	void * acquire(size_t bytes) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto it = free_blocks.find(bytes);
+			if (it != free_blocks.end() && !it->second.empty()) {
+				void * data = it->second.back();
+				it->second.pop_back();
+				return data;
+			}
+		}
+		return alloc_block(bytes);
+	}
+
+	void release(void * data) {
+		if (!data) return;
+		const size_t bytes = block_size(data);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			std::vector<void *>& blocks = free_blocks[bytes];
+			if (blocks.size() < max_free_per_size) {
+				blocks.push_back(data);
+				return;
+			}
+		}
+		free_block(data);
+	}
+
+	static size_t block_size(void * data) {
+		size_t bytes;
+		memcpy(&bytes, (char *)data - ALIGNMENT, sizeof(bytes));
+		return bytes;
+	}
+
+private:
+
+	static void * alloc_block(size_t bytes) {
+		const size_t total = bytes + ALIGNMENT;
+	#ifdef _WIN32
+		char * base = (char *)_aligned_malloc(total, ALIGNMENT);
+	#else
+		char * base = nullptr;
+		if (posix_memalign((void **)&base, ALIGNMENT, total) != 0) base = nullptr;
+	#endif
+		if (!base) return nullptr;
+		memset(base, 0, total);
+		memcpy(base, &bytes, sizeof(bytes));
+		return base + ALIGNMENT;
+	}
+
+	static void free_block(void * data) {
+		char * base = (char *)data - ALIGNMENT;
+	#ifdef _WIN32
+		_aligned_free(base);
+	#else
+		free(base);
+	#endif
+	}
+
+	std::map<size_t, std::vector<void *> > free_blocks;
+	std::mutex mutex;
+};
+
+// the pool shared by all cameras
+inline BufferPool& buffer_pool() {
+	static BufferPool pool;
+	return pool;
+}
+
+#endif // REALSENSE_BUFFERPOOL_H
@@ -0,0 +1,906 @@
+#ifndef REALSENSE_KERNELS_H
+#define REALSENSE_KERNELS_H
+
+/*
+	Per-pixel processing kernels for the depth pipeline.
+	These only depend on glm, not on napi or librealsense, so that they can run on any thread.
+
+	SIMD variants (SSE4.1 and AVX2) are compiled with target attributes and selected at runtime,
+	so the addon still runs on machines without AVX2.
+*/
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+#include "al_glm.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+	#define KERNELS_X86 1
+	#include <immintrin.h>
+	#if defined(_MSC_VER)
+		#include <intrin.h>
+		// msvc allows intrinsics in any function
+		#define KERNELS_TARGET_SSE41
+		#define KERNELS_TARGET_AVX2
+		#define KERNELS_TARGET_AVX2_F16C
+	#else
+		#define KERNELS_TARGET_SSE41 __attribute__((target("sse4.1")))
+		#define KERNELS_TARGET_AVX2 __attribute__((target("avx2")))
+		#define KERNELS_TARGET_AVX2_F16C __attribute__((target("avx2,f16c")))
+	#endif
+#endif
+
+enum SimdLevel {
+	SIMD_NONE = 0,
+	SIMD_SSE41,
+	SIMD_AVX2
+};
+
+// detect the best instruction set this CPU supports (cached after the first call)
+inline SimdLevel simd_level() {
+	static const SimdLevel level = []() {
+	#if defined(KERNELS_X86) && defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0);
+		const int max_leaf = info[0];
+		__cpuid(info, 1);
+		const bool sse41 = (info[2] & (1 << 19)) != 0;
+		const bool osxsave = (info[2] & (1 << 27)) != 0;
+		bool avx2 = false;
+		if (max_leaf >= 7 && osxsave && (_xgetbv(0) & 6) == 6) {
+			__cpuidex(info, 7, 0);
+			avx2 = (info[1] & (1 << 5)) != 0;
+		}
+		return avx2 ? SIMD_AVX2 : sse41 ? SIMD_SSE41 : SIMD_NONE;
+	#elif defined(KERNELS_X86)
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") ? SIMD_AVX2 : __builtin_cpu_supports("sse4.1") ? SIMD_SSE41 : SIMD_NONE;
+	#else
+		return SIMD_NONE;
+	#endif
+	}();
+	return level;
+}
+
+// whether the CPU converts half floats (F16C, CPUID.1:ECX bit 29), for kernels compiled with KERNELS_TARGET_AVX2_F16C
+// (AVX2 CPUs have it, but some VMs mask it out, so it is checked separately)
+inline bool simd_f16c() {
+	static const bool f16c = []() {
+	#if defined(KERNELS_X86) && defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 1);
+		return (info[2] & (1 << 29)) != 0;
+	#elif defined(KERNELS_X86)
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("f16c") != 0;
+	#else
+		return false;
+	#endif
+	}();
+	return f16c;
+}
+
+// false if the min/max box is unbounded (e.g. set to -Infinity, Infinity), so culling can be skipped
+inline bool box_culls(glm::vec3 min, glm::vec3 max) {
+	return !(min.x == -INFINITY && min.y == -INFINITY && min.z == -INFINITY && max.x == INFINITY && max.y == INFINITY && max.z == INFINITY);
+}
+
+// Everything the point kernel needs to turn depth into a transformed, culled vertex
+// With columns c of the model matrix, and the pixel's ray (rx, ry) at unit depth,
+// the vertex is z * (c0*rx - c1*ry - c2) + c3
+// (this includes the flip from the intel frame, y down & z forward, to GL)
+struct PointKernelParams {
+	glm::vec3 c0, c1, c2, c3;
+	glm::vec3 min, max;
+	float units;
+	// depths (in meters) at or below this are culled along with the box: 
+	// 0 to drop pixels with no reading (e.g. flying pixels that were zeroed), otherwise -1, which keeps them
+	float min_depth;
+
+	// which specialization of the kernel this needs:
+	bool identity;	// the transform is the identity matrix, so only the flip is needed
+	bool cull;		// the min/max box or min_depth could exclude something
+	bool emit_indices;	// write the index list (not needed when the vertices will be meshed)
+
+	PointKernelParams(const glm::mat4& transform, glm::vec3 min, glm::vec3 max, float units, bool emit_indices = true, bool drop_zero = false)
+	: c0(transform[0]), c1(transform[1]), c2(transform[2]), c3(transform[3]),
+	  min(min), max(max), units(units), 
+	  min_depth(drop_zero ? 0.f : -1.f),
+	  identity(transform == glm::mat4(1.f)), 
+	  cull(drop_zero || box_culls(min, max)),
+	  emit_indices(emit_indices) {}
+};
+
+// Process a run of n depth pixels:
+// writes n vertices, and appends the index (base + offset) of each vertex inside the min/max box (and above min_depth) to indices
+// returns the number of indices written
+typedef uint32_t (*PointKernel)(const PointKernelParams& k, const uint16_t * depth, const float * rx, const float * ry, int n, uint32_t base, glm::vec3 * vertices, uint32_t * indices);
+
+// The kernels are templated on the options in PointKernelParams, so that each combination compiles to a loop without those branches.
+// point_kernel() picks the specialization once per frame.
+template<bool IDENTITY, bool CULL, bool INDICES>
+inline uint32_t point_kernel_scalar(const PointKernelParams& k, const uint16_t * depth, const float * rx, const float * ry, int n, uint32_t base, glm::vec3 * vertices, uint32_t * indices) {
+	uint32_t count = 0;
+	for (int x=0; x<n; x++) {
+		const float z = depth[x] * k.units;
+		glm::vec3& v = vertices[x];
+		if (IDENTITY) {
+			v = glm::vec3(z*rx[x], -z*ry[x], -z);
+		} else {
+			v = z * (k.c0*rx[x] - k.c1*ry[x] - k.c2) + k.c3;
+		}
+
+		// meshless index array:
+		if (INDICES && (!CULL || (z > k.min_depth && v.x > k.min.x && v.y > k.min.y && v.z > k.min.z && v.x < k.max.x && v.y < k.max.y && v.z < k.max.z))) {
+			indices[count] = base + x;
+			count++;
+		}
+	}
+	return count;
+}
+
+#ifdef KERNELS_X86
+
+// For each 4-bit mask, the byte shuffle that packs the selected 32-bit lanes to the front
+struct CompressTable4 {
+	alignas(16) uint8_t shuffle[16][16];
+	uint8_t count[16];
+
+	CompressTable4() {
+		for (int m=0; m<16; m++) {
+			int n = 0;
+			for (int lane=0; lane<4; lane++) {
+				if (m & (1 << lane)) {
+					for (int b=0; b<4; b++) shuffle[m][n*4 + b] = lane*4 + b;
+					n++;
+				}
+			}
+			count[m] = n;
+			// unused lanes are don't-care
+			for (int b=n*4; b<16; b++) shuffle[m][b] = 0x80;
+		}
+	}
+};
+
+// For each 8-bit mask, the dword permutation that packs the selected lanes to the front
+struct CompressTable8 {
+	alignas(32) uint32_t permute[256][8];
+	uint8_t count[256];
+
+	CompressTable8() {
+		for (int m=0; m<256; m++) {
+			int n = 0;
+			for (int lane=0; lane<8; lane++) {
+				if (m & (1 << lane)) permute[m][n++] = lane;
+			}
+			count[m] = n;
+			for (int lane=n; lane<8; lane++) permute[m][lane] = 0;
+		}
+	}
+};
+
+inline const CompressTable4& compress_table4() {
+	static const CompressTable4 table;
+	return table;
+}
+
+inline const CompressTable8& compress_table8() {
+	static const CompressTable8 table;
+	return table;
+}
+
+// interleave 4 x, y, z into 12 floats of xyz
+KERNELS_TARGET_SSE41 inline void store_xyz4(float * out, __m128 x, __m128 y, __m128 z) {
+	const __m128 xy01 = _mm_unpacklo_ps(x, y);	// x0 y0 x1 y1
+	const __m128 xy23 = _mm_unpackhi_ps(x, y);	// x2 y2 x3 y3
+	const __m128 zx01 = _mm_unpacklo_ps(z, x);	// z0 x0 z1 x1
+	const __m128 zx23 = _mm_unpackhi_ps(z, x);	// z2 x2 z3 x3
+	const __m128 yz01 = _mm_unpacklo_ps(y, z);	// y0 z0 y1 z1
+	const __m128 yz23 = _mm_unpackhi_ps(y, z);	// y2 z2 y3 z3
+	_mm_storeu_ps(out + 0, _mm_shuffle_ps(xy01, zx01, _MM_SHUFFLE(3, 0, 1, 0)));	// x0 y0 z0 x1
+	_mm_storeu_ps(out + 4, _mm_shuffle_ps(yz01, xy23, _MM_SHUFFLE(1, 0, 3, 2)));	// y1 z1 x2 y2
+	_mm_storeu_ps(out + 8, _mm_shuffle_ps(zx23, yz23, _MM_SHUFFLE(3, 2, 3, 0)));	// z2 x3 y3 z3
+}
+
+// interleave 8 x, y, z into 24 floats of xyz
+// (as store_xyz4 within each 128-bit lane, then put the lanes in order)
+KERNELS_TARGET_AVX2 inline void store_xyz8(float * out, __m256 x, __m256 y, __m256 z) {
+	const __m256 xy01 = _mm256_unpacklo_ps(x, y);
+	const __m256 xy23 = _mm256_unpackhi_ps(x, y);
+	const __m256 zx01 = _mm256_unpacklo_ps(z, x);
+	const __m256 zx23 = _mm256_unpackhi_ps(z, x);
+	const __m256 yz01 = _mm256_unpacklo_ps(y, z);
+	const __m256 yz23 = _mm256_unpackhi_ps(y, z);
+	const __m256 o0 = _mm256_shuffle_ps(xy01, zx01, _MM_SHUFFLE(3, 0, 1, 0));
+	const __m256 o1 = _mm256_shuffle_ps(yz01, xy23, _MM_SHUFFLE(1, 0, 3, 2));
+	const __m256 o2 = _mm256_shuffle_ps(zx23, yz23, _MM_SHUFFLE(3, 2, 3, 0));
+	_mm256_storeu_ps(out + 0, _mm256_permute2f128_ps(o0, o1, 0x20));
+	_mm256_storeu_ps(out + 8, _mm256_permute2f128_ps(o2, o0, 0x30));
+	_mm256_storeu_ps(out + 16, _mm256_permute2f128_ps(o1, o2, 0x31));
+}
+
+// 4 points per iteration
+// surviving indices are packed with a shuffle table and stored unconditionally, advancing by the mask's popcount
+// (the stores may write up to 3 lanes past the last survivor, but never past base + n)
+template<bool IDENTITY, bool CULL, bool INDICES>
+KERNELS_TARGET_SSE41 inline uint32_t point_kernel_sse41(const PointKernelParams& k, const uint16_t * depth, const float * rx, const float * ry, int n, uint32_t base, glm::vec3 * vertices, uint32_t * indices) {
+	const CompressTable4& table = compress_table4();
+	const __m128 units = _mm_set1_ps(k.units);
+	const __m128 zero = _mm_setzero_ps();
+	// per component: a = c0*rx - c1*ry - c2, v = z*a + c3
+	const __m128 c0x = _mm_set1_ps(k.c0.x), c0y = _mm_set1_ps(k.c0.y), c0z = _mm_set1_ps(k.c0.z);
+	const __m128 c1x = _mm_set1_ps(k.c1.x), c1y = _mm_set1_ps(k.c1.y), c1z = _mm_set1_ps(k.c1.z);
+	const __m128 c2x = _mm_set1_ps(k.c2.x), c2y = _mm_set1_ps(k.c2.y), c2z = _mm_set1_ps(k.c2.z);
+	const __m128 c3x = _mm_set1_ps(k.c3.x), c3y = _mm_set1_ps(k.c3.y), c3z = _mm_set1_ps(k.c3.z);
+	const __m128 minx = _mm_set1_ps(k.min.x), miny = _mm_set1_ps(k.min.y), minz = _mm_set1_ps(k.min.z);
+	const __m128 maxx = _mm_set1_ps(k.max.x), maxy = _mm_set1_ps(k.max.y), maxz = _mm_set1_ps(k.max.z);
+	const __m128 min_depth = _mm_set1_ps(k.min_depth);
+	__m128i idx = _mm_add_epi32(_mm_set1_epi32(base), _mm_setr_epi32(0, 1, 2, 3));
+	const __m128i step = _mm_set1_epi32(4);
+
+	uint32_t count = 0;
+	int x = 0;
+	for (; x + 4 <= n; x += 4) {
+		const __m128i d = _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i *)(depth + x)));
+		const __m128 z = _mm_mul_ps(_mm_cvtepi32_ps(d), units);
+		const __m128 ax = _mm_loadu_ps(rx + x);
+		const __m128 ay = _mm_loadu_ps(ry + x);
+
+		__m128 vx, vy, vz;
+		if (IDENTITY) {
+			vx = _mm_mul_ps(z, ax);
+			vy = _mm_sub_ps(zero, _mm_mul_ps(z, ay));
+			vz = _mm_sub_ps(zero, z);
+		} else {
+			vx = _mm_add_ps(_mm_mul_ps(z, _mm_sub_ps(_mm_sub_ps(_mm_mul_ps(c0x, ax), _mm_mul_ps(c1x, ay)), c2x)), c3x);
+			vy = _mm_add_ps(_mm_mul_ps(z, _mm_sub_ps(_mm_sub_ps(_mm_mul_ps(c0y, ax), _mm_mul_ps(c1y, ay)), c2y)), c3y);
+			vz = _mm_add_ps(_mm_mul_ps(z, _mm_sub_ps(_mm_sub_ps(_mm_mul_ps(c0z, ax), _mm_mul_ps(c1z, ay)), c2z)), c3z);
+		}
+		store_xyz4((float *)(vertices + x), vx, vy, vz);
+
+		if (INDICES) {
+			if (CULL) {
+				__m128 inside = _mm_and_ps(_mm_cmpgt_ps(vx, minx), _mm_cmplt_ps(vx, maxx));
+				inside = _mm_and_ps(inside, _mm_and_ps(_mm_cmpgt_ps(vy, miny), _mm_cmplt_ps(vy, maxy)));
+				inside = _mm_and_ps(inside, _mm_and_ps(_mm_cmpgt_ps(vz, minz), _mm_cmplt_ps(vz, maxz)));
+				inside = _mm_and_ps(inside, _mm_cmpgt_ps(z, min_depth));
+				const int mask = _mm_movemask_ps(inside);
+
+				const __m128i packed = _mm_shuffle_epi8(idx, _mm_load_si128((const __m128i *)table.shuffle[mask]));
+				_mm_storeu_si128((__m128i *)(indices + count), packed);
+				count += table.count[mask];
+			} else {
+				_mm_storeu_si128((__m128i *)(indices + count), idx);
+				count += 4;
+			}
+			idx = _mm_add_epi32(idx, step);
+		}
+	}
+	return count + point_kernel_scalar<IDENTITY, CULL, INDICES>(k, depth + x, rx + x, ry + x, n - x, base + x, vertices + x, indices + count);
+}
+
+// 8 points per iteration, compressing indices with a lane permutation
+template<bool IDENTITY, bool CULL, bool INDICES>
+KERNELS_TARGET_AVX2 inline uint32_t point_kernel_avx2(const PointKernelParams& k, const uint16_t * depth, const float * rx, const float * ry, int n, uint32_t base, glm::vec3 * vertices, uint32_t * indices) {
+	const CompressTable8& table = compress_table8();
+	const __m256 units = _mm256_set1_ps(k.units);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 c0x = _mm256_set1_ps(k.c0.x), c0y = _mm256_set1_ps(k.c0.y), c0z = _mm256_set1_ps(k.c0.z);
+	const __m256 c1x = _mm256_set1_ps(k.c1.x), c1y = _mm256_set1_ps(k.c1.y), c1z = _mm256_set1_ps(k.c1.z);
+	const __m256 c2x = _mm256_set1_ps(k.c2.x), c2y = _mm256_set1_ps(k.c2.y), c2z = _mm256_set1_ps(k.c2.z);
+	const __m256 c3x = _mm256_set1_ps(k.c3.x), c3y = _mm256_set1_ps(k.c3.y), c3z = _mm256_set1_ps(k.c3.z);
+	const __m256 minx = _mm256_set1_ps(k.min.x), miny = _mm256_set1_ps(k.min.y), minz = _mm256_set1_ps(k.min.z);
+	const __m256 maxx = _mm256_set1_ps(k.max.x), maxy = _mm256_set1_ps(k.max.y), maxz = _mm256_set1_ps(k.max.z);
+	const __m256 min_depth = _mm256_set1_ps(k.min_depth);
+	__m256i idx = _mm256_add_epi32(_mm256_set1_epi32(base), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+	const __m256i step = _mm256_set1_epi32(8);
+
+	uint32_t count = 0;
+	int x = 0;
+	for (; x + 8 <= n; x += 8) {
+		const __m256i d = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(depth + x)));
+		const __m256 z = _mm256_mul_ps(_mm256_cvtepi32_ps(d), units);
+		const __m256 ax = _mm256_loadu_ps(rx + x);
+		const __m256 ay = _mm256_loadu_ps(ry + x);
+
+		__m256 vx, vy, vz;
+		if (IDENTITY) {
+			vx = _mm256_mul_ps(z, ax);
+			vy = _mm256_sub_ps(zero, _mm256_mul_ps(z, ay));
+			vz = _mm256_sub_ps(zero, z);
+		} else {
+			vx = _mm256_add_ps(_mm256_mul_ps(z, _mm256_sub_ps(_mm256_sub_ps(_mm256_mul_ps(c0x, ax), _mm256_mul_ps(c1x, ay)), c2x)), c3x);
+			vy = _mm256_add_ps(_mm256_mul_ps(z, _mm256_sub_ps(_mm256_sub_ps(_mm256_mul_ps(c0y, ax), _mm256_mul_ps(c1y, ay)), c2y)), c3y);
+			vz = _mm256_add_ps(_mm256_mul_ps(z, _mm256_sub_ps(_mm256_sub_ps(_mm256_mul_ps(c0z, ax), _mm256_mul_ps(c1z, ay)), c2z)), c3z);
+		}
+		store_xyz8((float *)(vertices + x), vx, vy, vz);
+
+		if (INDICES) {
+			if (CULL) {
+				__m256 inside = _mm256_and_ps(_mm256_cmp_ps(vx, minx, _CMP_GT_OQ), _mm256_cmp_ps(vx, maxx, _CMP_LT_OQ));
+				inside = _mm256_and_ps(inside, _mm256_and_ps(_mm256_cmp_ps(vy, miny, _CMP_GT_OQ), _mm256_cmp_ps(vy, maxy, _CMP_LT_OQ)));
+				inside = _mm256_and_ps(inside, _mm256_and_ps(_mm256_cmp_ps(vz, minz, _CMP_GT_OQ), _mm256_cmp_ps(vz, maxz, _CMP_LT_OQ)));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(z, min_depth, _CMP_GT_OQ));
+				const int mask = _mm256_movemask_ps(inside);
+
+				const __m256i packed = _mm256_permutevar8x32_epi32(idx, _mm256_load_si256((const __m256i *)table.permute[mask]));
+				_mm256_storeu_si256((__m256i *)(indices + count), packed);
+				count += table.count[mask];
+			} else {
+				_mm256_storeu_si256((__m256i *)(indices + count), idx);
+				count += 8;
+			}
+			idx = _mm256_add_epi32(idx, step);
+		}
+	}
+	return count + point_kernel_scalar<IDENTITY, CULL, INDICES>(k, depth + x, rx + x, ry + x, n - x, base + x, vertices + x, indices + count);
+}
+
+#endif // KERNELS_X86
+
+// the fastest point kernel for this CPU, specialized for the options in k
+inline PointKernel point_kernel(const PointKernelParams& k) {
+	// all specializations, indexed by [simd][identity][cull][indices]
+	#define POINT_KERNELS(NAME) { \
+		{ { NAME<false, false, false>, NAME<false, false, true> }, { NAME<false, true, false>, NAME<false, true, true> } }, \
+		{ { NAME<true, false, false>, NAME<true, false, true> }, { NAME<true, true, false>, NAME<true, true, true> } } \
+	}
+	static const PointKernel kernels[3][2][2][2] = {
+		POINT_KERNELS(point_kernel_scalar),
+	#ifdef KERNELS_X86
+		POINT_KERNELS(point_kernel_sse41),
+		POINT_KERNELS(point_kernel_avx2),
+	#else
+		POINT_KERNELS(point_kernel_scalar),
+		POINT_KERNELS(point_kernel_scalar),
+	#endif
+	};
+	#undef POINT_KERNELS
+	return kernels[simd_level()][k.identity][k.cull][k.emit_indices];
+}
+
+// Z16 downsampling before deprojection: each factor x factor block of depth pixels becomes one pixel. 
+// The block's nearest valid depth (the min of its nonzero values) is taken, which keeps thin foreground objects, 
+// or with `median`, the median of its valid depths (the lower middle for an even count), which rejects outliers. 
+// A block with no valid depth gives 0. 
+
+// Per column, the min over `factor` rows of (depth - 1), wrapping, so that 0 (no reading) becomes 0xffff and never wins. 
+inline void column_min_z16_scalar(const uint8_t * data, int stride, int factor, int n, uint16_t * out) {
+	for (int x=0; x<n; x++) out[x] = 0xffff;
+	for (int r=0; r<factor; r++) {
+		const uint16_t * row = (const uint16_t *)(data + r*stride);
+		for (int x=0; x<n; x++) out[x] = std::min(out[x], uint16_t(row[x] - 1));
+	}
+}
+
+#ifdef KERNELS_X86
+
+KERNELS_TARGET_SSE41 inline void column_min_z16_sse41(const uint8_t * data, int stride, int factor, int n, uint16_t * out) {
+	const __m128i one = _mm_set1_epi16(1);
+	int x = 0;
+	for (; x + 8 <= n; x += 8) {
+		__m128i m = _mm_set1_epi16(-1);
+		for (int r=0; r<factor; r++) {
+			const __m128i v = _mm_loadu_si128((const __m128i *)((const uint16_t *)(data + r*stride) + x));
+			m = _mm_min_epu16(m, _mm_sub_epi16(v, one));
+		}
+		_mm_storeu_si128((__m128i *)(out + x), m);
+	}
+	if (x < n) column_min_z16_scalar(data + x*2, stride, factor, n - x, out + x);
+}
+
+KERNELS_TARGET_AVX2 inline void column_min_z16_avx2(const uint8_t * data, int stride, int factor, int n, uint16_t * out) {
+	const __m256i one = _mm256_set1_epi16(1);
+	int x = 0;
+	for (; x + 16 <= n; x += 16) {
+		__m256i m = _mm256_set1_epi16(-1);
+		for (int r=0; r<factor; r++) {
+			const __m256i v = _mm256_loadu_si256((const __m256i *)((const uint16_t *)(data + r*stride) + x));
+			m = _mm256_min_epu16(m, _mm256_sub_epi16(v, one));
+		}
+		_mm256_storeu_si256((__m256i *)(out + x), m);
+	}
+	if (x < n) column_min_z16_sse41(data + x*2, stride, factor, n - x, out + x);
+}
+
+#endif // KERNELS_X86
+
+// Write output rows [y0, y1) of the (width/factor) x (height/factor) downsampled image (partial blocks at the edges are dropped). 
+// `scratch` must hold at least max(width, factor*factor) values. 
+inline void downsample_z16_rows(const uint8_t * data, int stride, int width, int factor, bool median, int y0, int y1, uint16_t * out, uint16_t * scratch) {
+	const int out_width = width / factor;
+#ifdef KERNELS_X86
+	const SimdLevel simd = simd_level();
+#endif
+	for (int y=y0; y<y1; y++) {
+		const uint8_t * block_row = data + size_t(y) * factor * stride;
+		uint16_t * dst = out + size_t(y) * out_width;
+
+		if (median) {
+			for (int x=0; x<out_width; x++) {
+				int count = 0;
+				for (int r=0; r<factor; r++) {
+					const uint16_t * src = (const uint16_t *)(block_row + r*stride) + x*factor;
+					for (int c=0; c<factor; c++) {
+						if (src[c]) scratch[count++] = src[c];
+					}
+				}
+				if (!count) {
+					dst[x] = 0;
+					continue;
+				}
+				uint16_t * mid = scratch + (count - 1)/2;
+				std::nth_element(scratch, mid, scratch + count);
+				dst[x] = *mid;
+			}
+			continue;
+		}
+
+		// min down the columns (the bulk of the work, vectorized), then across each block:
+		const int n = out_width * factor;
+	#ifdef KERNELS_X86
+		if (simd == SIMD_AVX2) column_min_z16_avx2(block_row, stride, factor, n, scratch);
+		else if (simd == SIMD_SSE41) column_min_z16_sse41(block_row, stride, factor, n, scratch);
+		else
+	#endif
+		column_min_z16_scalar(block_row, stride, factor, n, scratch);
+		for (int x=0; x<out_width; x++) {
+			const uint16_t * block = scratch + x*factor;
+			uint16_t m = block[0];
+			for (int c=1; c<factor; c++) m = std::min(m, block[c]);
+			dst[x] = uint16_t(m + 1);
+		}
+	}
+}
+
+// Flying pixel rejection: copy a row of Z16 depth to `out`, zeroing each pixel whose depth differs from any of its valid 
+// left/right/up/down neighbours by more than `ratio` of its own depth (ratio in Q16, i.e. ratio * 65536). 
+// These are the pixels that straddle a foreground edge and the background, which deproject to streaks between them. 
+// `up` and `down` are the rows above & below, or nullptr at the edges of the image. 
+inline bool flying_z16(uint16_t c, uint16_t neighbour, uint16_t ratio) {
+	const int tolerance = (uint32_t(c) * ratio) >> 16;
+	return neighbour && std::abs(int(c) - int(neighbour)) > tolerance;
+}
+
+inline void reject_flying_z16_scalar(const uint16_t * up, const uint16_t * row, const uint16_t * down, int x0, int x1, int n, uint16_t ratio, uint16_t * out) {
+	for (int x=x0; x<x1; x++) {
+		const uint16_t c = row[x];
+		const bool flying = (x > 0 && flying_z16(c, row[x - 1], ratio)) || (x + 1 < n && flying_z16(c, row[x + 1], ratio))
+			|| flying_z16(c, up[x], ratio) || flying_z16(c, down[x], ratio);
+		out[x] = flying ? 0 : c;
+	}
+}
+
+#ifdef KERNELS_X86
+
+// lanes of neighbour that are valid and differ from c by more than tolerance
+KERNELS_TARGET_SSE41 inline __m128i flying_z16_sse41(__m128i c, __m128i neighbour, __m128i tolerance) {
+	const __m128i absdiff = _mm_sub_epi16(_mm_max_epu16(c, neighbour), _mm_min_epu16(c, neighbour));
+	const __m128i within = _mm_cmpeq_epi16(_mm_min_epu16(absdiff, tolerance), absdiff);
+	return _mm_andnot_si128(_mm_or_si128(within, _mm_cmpeq_epi16(neighbour, _mm_setzero_si128())), _mm_set1_epi16(-1));
+}
+
+KERNELS_TARGET_SSE41 inline void reject_flying_z16_sse41(const uint16_t * up, const uint16_t * row, const uint16_t * down, int n, uint16_t ratio, uint16_t * out) {
+	const __m128i r = _mm_set1_epi16(int16_t(ratio));
+	int x = 1;
+	reject_flying_z16_scalar(up, row, down, 0, std::min(1, n), n, ratio, out);
+	// 8 at a time, while the right neighbours are in the row:
+	for (; x + 9 <= n; x += 8) {
+		const __m128i c = _mm_loadu_si128((const __m128i *)(row + x));
+		const __m128i tolerance = _mm_mulhi_epu16(c, r);
+		__m128i flying = flying_z16_sse41(c, _mm_loadu_si128((const __m128i *)(row + x - 1)), tolerance);
+		flying = _mm_or_si128(flying, flying_z16_sse41(c, _mm_loadu_si128((const __m128i *)(row + x + 1)), tolerance));
+		flying = _mm_or_si128(flying, flying_z16_sse41(c, _mm_loadu_si128((const __m128i *)(up + x)), tolerance));
+		flying = _mm_or_si128(flying, flying_z16_sse41(c, _mm_loadu_si128((const __m128i *)(down + x)), tolerance));
+		_mm_storeu_si128((__m128i *)(out + x), _mm_andnot_si128(flying, c));
+	}
+	reject_flying_z16_scalar(up, row, down, std::max(x, 1), n, n, ratio, out);
+}
+
+KERNELS_TARGET_AVX2 inline __m256i flying_z16_avx2(__m256i c, __m256i neighbour, __m256i tolerance) {
+	const __m256i absdiff = _mm256_sub_epi16(_mm256_max_epu16(c, neighbour), _mm256_min_epu16(c, neighbour));
+	const __m256i within = _mm256_cmpeq_epi16(_mm256_min_epu16(absdiff, tolerance), absdiff);
+	return _mm256_andnot_si256(_mm256_or_si256(within, _mm256_cmpeq_epi16(neighbour, _mm256_setzero_si256())), _mm256_set1_epi16(-1));
+}
+
+KERNELS_TARGET_AVX2 inline void reject_flying_z16_avx2(const uint16_t * up, const uint16_t * row, const uint16_t * down, int n, uint16_t ratio, uint16_t * out) {
+	const __m256i r = _mm256_set1_epi16(int16_t(ratio));
+	int x = 1;
+	reject_flying_z16_scalar(up, row, down, 0, std::min(1, n), n, ratio, out);
+	for (; x + 17 <= n; x += 16) {
+		const __m256i c = _mm256_loadu_si256((const __m256i *)(row + x));
+		const __m256i tolerance = _mm256_mulhi_epu16(c, r);
+		__m256i flying = flying_z16_avx2(c, _mm256_loadu_si256((const __m256i *)(row + x - 1)), tolerance);
+		flying = _mm256_or_si256(flying, flying_z16_avx2(c, _mm256_loadu_si256((const __m256i *)(row + x + 1)), tolerance));
+		flying = _mm256_or_si256(flying, flying_z16_avx2(c, _mm256_loadu_si256((const __m256i *)(up + x)), tolerance));
+		flying = _mm256_or_si256(flying, flying_z16_avx2(c, _mm256_loadu_si256((const __m256i *)(down + x)), tolerance));
+		_mm256_storeu_si256((__m256i *)(out + x), _mm256_andnot_si256(flying, c));
+	}
+	reject_flying_z16_scalar(up, row, down, std::max(x, 1), n, n, ratio, out);
+}
+
+#endif // KERNELS_X86
+
+inline void reject_flying_z16(const uint16_t * up, const uint16_t * row, const uint16_t * down, int n, uint16_t ratio, uint16_t * out) {
+	// a missing neighbour row is compared with the row itself, which never rejects:
+	if (!up) up = row;
+	if (!down) down = row;
+#ifdef KERNELS_X86
+	const SimdLevel simd = simd_level();
+	if (simd == SIMD_AVX2) return reject_flying_z16_avx2(up, row, down, n, ratio, out);
+	if (simd == SIMD_SSE41) return reject_flying_z16_sse41(up, row, down, n, ratio, out);
+#endif
+	reject_flying_z16_scalar(up, row, down, 0, n, n, ratio, out);
+}
+
+// Temporal smoothing of Z16 depth, with per-pixel state: 
+// `state` holds the smoothed depth of each pixel (0 if it has none), and `missing` how many frames in a row it has had no reading. 
+// A valid reading moves the state toward it by alpha (an exponential moving average), unless it differs by more than `threshold` 
+// (depth units), in which case the state jumps straight to it, so that real motion isn't smeared. 
+// Without a reading, the state is held for up to `persistence` frames, then dropped. 
+// As the state has no fractional bits, a steady reading is only approached to within 1/(2*alpha) units, which also damps jitter. 
+// The smoothed depth is left in `state`. 
+struct SmoothZ16Params {
+	int16_t alpha;	// Q15, i.e. alpha * 32768 (at most 32767)
+	uint16_t threshold;	// at most 32767, so that differences fit a signed 16-bit lane
+	uint16_t persistence;
+
+	SmoothZ16Params(float alpha, int threshold, int persistence) 
+	: alpha(int16_t(std::min(std::max(alpha, 0.f), 1.f) * 32767.f + 0.5f)), 
+	  threshold(uint16_t(std::min(std::max(threshold, 0), 32767))), 
+	  persistence(uint16_t(std::min(std::max(persistence, 0), 65535))) {}
+};
+
+inline void smooth_z16_scalar(const SmoothZ16Params& k, const uint16_t * depth, int n, uint16_t * state, uint16_t * missing) {
+	for (int i=0; i<n; i++) {
+		const uint16_t d = depth[i];
+		uint16_t s = state[i];
+		if (d) {
+			const int diff = int(d) - int(s);
+			if (s && std::abs(diff) <= k.threshold) {
+				// as _mm_mulhrs_epi16:
+				s = uint16_t(s + ((diff * k.alpha + 0x4000) >> 15));
+			} else {
+				s = d;
+			}
+			missing[i] = 0;
+		} else if (missing[i] < k.persistence) {
+			missing[i]++;
+		} else {
+			s = 0;
+		}
+		state[i] = s;
+	}
+}
+
+#ifdef KERNELS_X86
+
+KERNELS_TARGET_SSE41 inline void smooth_z16_sse41(const SmoothZ16Params& k, const uint16_t * depth, int n, uint16_t * state, uint16_t * missing) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi16(1);
+	const __m128i alpha = _mm_set1_epi16(k.alpha);
+	const __m128i threshold = _mm_set1_epi16(k.threshold);
+	const __m128i persistence = _mm_set1_epi16(k.persistence);
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m128i d = _mm_loadu_si128((const __m128i *)(depth + i));
+		const __m128i s = _mm_loadu_si128((const __m128i *)(state + i));
+		const __m128i m = _mm_loadu_si128((const __m128i *)(missing + i));
+
+		// valid reading: smooth if there is state within the threshold, otherwise jump
+		const __m128i absdiff = _mm_sub_epi16(_mm_max_epu16(d, s), _mm_min_epu16(d, s));
+		const __m128i near = _mm_andnot_si128(_mm_cmpeq_epi16(s, zero), _mm_cmpeq_epi16(_mm_min_epu16(absdiff, threshold), absdiff));
+		const __m128i smoothed = _mm_add_epi16(s, _mm_mulhrs_epi16(_mm_sub_epi16(d, s), alpha));
+		const __m128i updated = _mm_blendv_epi8(d, smoothed, near);
+
+		// no reading: hold the state while missing < persistence
+		const __m128i hold = _mm_andnot_si128(_mm_cmpeq_epi16(_mm_min_epu16(m, persistence), persistence), _mm_set1_epi16(-1));
+		const __m128i held = _mm_and_si128(s, hold);
+		const __m128i counted = _mm_add_epi16(m, _mm_and_si128(hold, one));
+
+		const __m128i valid = _mm_cmpeq_epi16(d, zero);	// (inverted)
+		_mm_storeu_si128((__m128i *)(state + i), _mm_blendv_epi8(updated, held, valid));
+		_mm_storeu_si128((__m128i *)(missing + i), _mm_and_si128(counted, valid));
+	}
+	if (i < n) smooth_z16_scalar(k, depth + i, n - i, state + i, missing + i);
+}
+
+KERNELS_TARGET_AVX2 inline void smooth_z16_avx2(const SmoothZ16Params& k, const uint16_t * depth, int n, uint16_t * state, uint16_t * missing) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i one = _mm256_set1_epi16(1);
+	const __m256i alpha = _mm256_set1_epi16(k.alpha);
+	const __m256i threshold = _mm256_set1_epi16(k.threshold);
+	const __m256i persistence = _mm256_set1_epi16(k.persistence);
+	int i = 0;
+	for (; i + 16 <= n; i += 16) {
+		const __m256i d = _mm256_loadu_si256((const __m256i *)(depth + i));
+		const __m256i s = _mm256_loadu_si256((const __m256i *)(state + i));
+		const __m256i m = _mm256_loadu_si256((const __m256i *)(missing + i));
+
+		const __m256i absdiff = _mm256_sub_epi16(_mm256_max_epu16(d, s), _mm256_min_epu16(d, s));
+		const __m256i near = _mm256_andnot_si256(_mm256_cmpeq_epi16(s, zero), _mm256_cmpeq_epi16(_mm256_min_epu16(absdiff, threshold), absdiff));
+		const __m256i smoothed = _mm256_add_epi16(s, _mm256_mulhrs_epi16(_mm256_sub_epi16(d, s), alpha));
+		const __m256i updated = _mm256_blendv_epi8(d, smoothed, near);
+
+		const __m256i hold = _mm256_andnot_si256(_mm256_cmpeq_epi16(_mm256_min_epu16(m, persistence), persistence), _mm256_set1_epi16(-1));
+		const __m256i held = _mm256_and_si256(s, hold);
+		const __m256i counted = _mm256_add_epi16(m, _mm256_and_si256(hold, one));
+
+		const __m256i valid = _mm256_cmpeq_epi16(d, zero);	// (inverted)
+		_mm256_storeu_si256((__m256i *)(state + i), _mm256_blendv_epi8(updated, held, valid));
+		_mm256_storeu_si256((__m256i *)(missing + i), _mm256_and_si256(counted, valid));
+	}
+	if (i < n) smooth_z16_sse41(k, depth + i, n - i, state + i, missing + i);
+}
+
+#endif // KERNELS_X86
+
+inline void smooth_z16(const SmoothZ16Params& k, const uint16_t * depth, int n, uint16_t * state, uint16_t * missing) {
+#ifdef KERNELS_X86
+	const SimdLevel simd = simd_level();
+	if (simd == SIMD_AVX2) return smooth_z16_avx2(k, depth, n, state, missing);
+	if (simd == SIMD_SSE41) return smooth_z16_sse41(k, depth, n, state, missing);
+#endif
+	smooth_z16_scalar(k, depth, n, state, missing);
+}
+
+// Triangulate quad rows [y0, y1) of an organized width x height vertex grid.
+// Each quad (a b / c d) is split into triangles (a d b) and (d a c), and a triangle is kept 
+// if all of its vertices are inside the min/max box, and its area is nonzero but less than maxarea 
+// (maxarea is compared with the cross-product length, i.e. twice the triangle area).
+// Writes the vertex indices of kept triangles to indices, and per quad sets bit 0 if (a d b) was kept and bit 1 if (d a c) was kept. 
+// Returns the number of indices written, at most (y1-y0)*(width-1)*6
+// (templated on whether the box can exclude anything, see PointKernelParams::cull)
+template<bool CULL>
+inline uint32_t mesh_rows_t(const glm::vec3 * vertices, int width, int y0, int y1, glm::vec3 min, glm::vec3 max, float maxarea, uint32_t * indices, uint8_t * quad_mask) {
+	// compare squared lengths to avoid the square roots:
+	const float maxarea2 = maxarea > 0.f ? maxarea*maxarea : 0.f;
+
+	// box tests for the top & bottom vertex rows of the current quad row
+	std::vector<uint8_t> inside_top(width, 1), inside_bottom(width, 1);
+	if (CULL) {
+		for (int x=0; x<width; x++) {
+			const glm::vec3& v = vertices[y0*width + x];
+			inside_bottom[x] = v.x > min.x && v.y > min.y && v.z > min.z && v.x < max.x && v.y < max.y && v.z < max.z;
+		}
+	}
+
+	uint32_t count = 0;
+	for (int y = y0; y < y1; ++y) {
+		if (CULL) {
+			inside_top.swap(inside_bottom);
+			for (int x=0; x<width; x++) {
+				const glm::vec3& v = vertices[(y+1)*width + x];
+				inside_bottom[x] = v.x > min.x && v.y > min.y && v.z > min.z && v.x < max.x && v.y < max.y && v.z < max.z;
+			}
+		}
+
+		for (int x = 0; x < width - 1; ++x) {
+			// indices of a quad
+			const uint32_t a = y * width + x, 
+				b = y * width + (x+1), 
+				c = (y+1)*width + x, 
+				d = (y+1)*width + (x+1);
+			const bool ad = inside_top[x] && inside_bottom[x+1];
+			uint8_t mask = 0;
+
+			if (ad && (inside_top[x+1] || inside_bottom[x])) {
+				const glm::vec3 da = vertices[d] - vertices[a];
+				if (inside_top[x+1]) {
+					// |cross product| of two sides gives area parallelogram, twice area of triangle
+					// this will be zero if there are degenerate points
+					const glm::vec3 daba = glm::cross(da, vertices[b] - vertices[a]);
+					const float abd2 = glm::dot(daba, daba);
+					if (abd2 > 0.f && abd2 < maxarea2) {
+						indices[count++] = a;
+						indices[count++] = d;
+						indices[count++] = b;
+						mask |= 1;
+					}
+				}
+				if (inside_bottom[x]) {
+					const glm::vec3 cada = glm::cross(vertices[c] - vertices[a], da);
+					const float acd2 = glm::dot(cada, cada);
+					if (acd2 > 0.f && acd2 < maxarea2) {
+						indices[count++] = d;
+						indices[count++] = a;
+						indices[count++] = c;
+						mask |= 2;
+					}
+				}
+			}
+			quad_mask[y * (width - 1) + x] = mask;
+		}
+	}
+	return count;
+}
+
+inline uint32_t mesh_rows(const glm::vec3 * vertices, int width, int y0, int y1, glm::vec3 min, glm::vec3 max, float maxarea, uint32_t * indices, uint8_t * quad_mask) {
+	return box_culls(min, max) ? mesh_rows_t<true>(vertices, width, y0, y1, min, max, maxarea, indices, quad_mask)
+		: mesh_rows_t<false>(vertices, width, y0, y1, min, max, maxarea, indices, quad_mask);
+}
+
+// Smooth normals for vertex rows [y0, y1) of a grid meshed by mesh_rows(), 
+// summing the face normals of the kept triangles around each vertex. 
+// The face normals are unnormalized cross products, so larger triangles weigh more. 
+// Vertices that belong to no triangle get a zero normal.
+inline void mesh_normals(const glm::vec3 * vertices, const uint8_t * quad_mask, int width, int height, int y0, int y1, glm::vec3 * normals) {
+	const int quads_per_row = width - 1;
+	// face normals of the two triangles of the quad whose top-left corner is (qx, qy):
+	#define V(X, Y) vertices[(Y)*width + (X)]
+	#define FACE_ADB(qx, qy) glm::cross(V(qx+1, qy+1) - V(qx, qy), V(qx+1, qy) - V(qx, qy))
+	#define FACE_DAC(qx, qy) glm::cross(V(qx, qy+1) - V(qx, qy), V(qx+1, qy+1) - V(qx, qy))
+	for (int y=y0; y<y1; y++) {
+		for (int x=0; x<width; x++) {
+			glm::vec3 n(0.f);
+			// this vertex is corner a of quad (x, y):
+			if (x < width-1 && y < height-1) {
+				const uint8_t m = quad_mask[y*quads_per_row + x];
+				if (m & 1) n += FACE_ADB(x, y);
+				if (m & 2) n += FACE_DAC(x, y);
+			}
+			// corner b of quad (x-1, y):
+			if (x > 0 && y < height-1) {
+				if (quad_mask[y*quads_per_row + x-1] & 1) n += FACE_ADB(x-1, y);
+			}
+			// corner c of quad (x, y-1):
+			if (x < width-1 && y > 0) {
+				if (quad_mask[(y-1)*quads_per_row + x] & 2) n += FACE_DAC(x, y-1);
+			}
+			// corner d of quad (x-1, y-1):
+			if (x > 0 && y > 0) {
+				const uint8_t m = quad_mask[(y-1)*quads_per_row + x-1];
+				if (m & 1) n += FACE_ADB(x-1, y-1);
+				if (m & 2) n += FACE_DAC(x-1, y-1);
+			}
+			const float len2 = glm::dot(n, n);
+			normals[y*width + x] = len2 > 0.f ? n / sqrtf(len2) : n;
+		}
+	}
+	#undef V
+	#undef FACE_ADB
+	#undef FACE_DAC
+}
+
+// Smooth normals straight from the organized vertex grid, without needing a mesh first.
+// With R, D, L, U the vectors from a vertex to its right, down, left & up neighbours, the normal is 
+// cross(D,R) + cross(L,D) + cross(U,L) + cross(R,U), which equals the central difference cross(D-U, R-L) when all neighbours are valid. 
+// Each term is the (doubled) area of a triangle around the vertex, so this is area weighted, 
+// and a term is only used if both of its neighbours are inside the min/max box and its area passes the same test as mesh_rows(), 
+// so normals don't bend across depth discontinuities. Vertices outside the box, or with no usable terms, get a zero normal. 
+struct GridNormalRows {
+	int width;
+	// three rows (above, current, below) of x, y, z and valid (1 or 0), each padded by one invalid column on each side:
+	std::vector<float> data;
+
+	GridNormalRows(int width) : width(width), data(3 * 4 * (width + 2), 0.f) {}
+
+	float * row(int r, int channel) { return &data[(r * 4 + channel) * (width + 2)]; }
+
+	void load(int r, const glm::vec3 * vertices, int height, int y, glm::vec3 min, glm::vec3 max) {
+		float * X = row(r, 0), * Y = row(r, 1), * Z = row(r, 2), * valid = row(r, 3);
+		for (int x=0; x<width+2; x++) valid[x] = 0.f;
+		if (y < 0 || y >= height) return;
+		const glm::vec3 * src = vertices + y*width;
+		for (int x=0; x<width; x++) {
+			const glm::vec3& v = src[x];
+			X[x+1] = v.x;
+			Y[x+1] = v.y;
+			Z[x+1] = v.z;
+			valid[x+1] = (v.x > min.x && v.y > min.y && v.z > min.z && v.x < max.x && v.y < max.y && v.z < max.z) ? 1.f : 0.f;
+		}
+	}
+};
+
+// normal of padded column x of the current row (row 1)
+inline glm::vec3 grid_normal_scalar(GridNormalRows& rows, int x, float maxarea2) {
+	const float * X = rows.row(1, 0), * Y = rows.row(1, 1), * Z = rows.row(1, 2), * valid = rows.row(1, 3);
+	if (valid[x] == 0.f) return glm::vec3(0.f);
+	const glm::vec3 c(X[x], Y[x], Z[x]);
+	const glm::vec3 r = glm::vec3(X[x+1], Y[x+1], Z[x+1]) - c;
+	const glm::vec3 l = glm::vec3(X[x-1], Y[x-1], Z[x-1]) - c;
+	const glm::vec3 u = glm::vec3(rows.row(0, 0)[x], rows.row(0, 1)[x], rows.row(0, 2)[x]) - c;
+	const glm::vec3 d = glm::vec3(rows.row(2, 0)[x], rows.row(2, 1)[x], rows.row(2, 2)[x]) - c;
+	const bool vr = valid[x+1] != 0.f, vl = valid[x-1] != 0.f;
+	const bool vu = rows.row(0, 3)[x] != 0.f, vd = rows.row(2, 3)[x] != 0.f;
+
+	glm::vec3 n(0.f);
+	glm::vec3 t;
+	float a2;
+	if (vd && vr) { t = glm::cross(d, r); a2 = glm::dot(t, t); if (a2 > 0.f && a2 < maxarea2) n += t; }
+	if (vl && vd) { t = glm::cross(l, d); a2 = glm::dot(t, t); if (a2 > 0.f && a2 < maxarea2) n += t; }
+	if (vu && vl) { t = glm::cross(u, l); a2 = glm::dot(t, t); if (a2 > 0.f && a2 < maxarea2) n += t; }
+	if (vr && vu) { t = glm::cross(r, u); a2 = glm::dot(t, t); if (a2 > 0.f && a2 < maxarea2) n += t; }
+	const float len2 = glm::dot(n, n);
+	return len2 > 0.f ? n / sqrtf(len2) : n;
+}
+
+#ifdef KERNELS_X86
+
+// one term of the normal sum, added to n if both neighbours are valid and the area is in range
+KERNELS_TARGET_AVX2 inline void grid_normal_term_avx2(
+	__m256 ax, __m256 ay, __m256 az, __m256 bx, __m256 by, __m256 bz, __m256 valid, __m256 maxarea2, 
+	__m256& nx, __m256& ny, __m256& nz
+) {
+	const __m256 tx = _mm256_sub_ps(_mm256_mul_ps(ay, bz), _mm256_mul_ps(az, by));
+	const __m256 ty = _mm256_sub_ps(_mm256_mul_ps(az, bx), _mm256_mul_ps(ax, bz));
+	const __m256 tz = _mm256_sub_ps(_mm256_mul_ps(ax, by), _mm256_mul_ps(ay, bx));
+	const __m256 a2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tx, tx), _mm256_mul_ps(ty, ty)), _mm256_mul_ps(tz, tz));
+	__m256 use = _mm256_and_ps(valid, _mm256_cmp_ps(a2, _mm256_setzero_ps(), _CMP_GT_OQ));
+	use = _mm256_and_ps(use, _mm256_cmp_ps(a2, maxarea2, _CMP_LT_OQ));
+	nx = _mm256_add_ps(nx, _mm256_and_ps(use, tx));
+	ny = _mm256_add_ps(ny, _mm256_and_ps(use, ty));
+	nz = _mm256_add_ps(nz, _mm256_and_ps(use, tz));
+}
+
+// normals for padded columns [1, width] of the current row, 8 at a time
+KERNELS_TARGET_AVX2 inline void grid_normals_row_avx2(GridNormalRows& rows, float maxarea2, glm::vec3 * normals) {
+	const int width = rows.width;
+	const float * X = rows.row(1, 0), * Y = rows.row(1, 1), * Z = rows.row(1, 2), * V = rows.row(1, 3);
+	const float * UX = rows.row(0, 0), * UY = rows.row(0, 1), * UZ = rows.row(0, 2), * UV = rows.row(0, 3);
+	const float * DX = rows.row(2, 0), * DY = rows.row(2, 1), * DZ = rows.row(2, 2), * DV = rows.row(2, 3);
+	const __m256 half = _mm256_set1_ps(0.5f);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 area2 = _mm256_set1_ps(maxarea2);
+
+	int x = 1;
+	for (; x + 8 <= width + 1; x += 8) {
+		const __m256 cx = _mm256_loadu_ps(X + x), cy = _mm256_loadu_ps(Y + x), cz = _mm256_loadu_ps(Z + x);
+		const __m256 rx = _mm256_sub_ps(_mm256_loadu_ps(X + x + 1), cx), ry = _mm256_sub_ps(_mm256_loadu_ps(Y + x + 1), cy), rz = _mm256_sub_ps(_mm256_loadu_ps(Z + x + 1), cz);
+		const __m256 lx = _mm256_sub_ps(_mm256_loadu_ps(X + x - 1), cx), ly = _mm256_sub_ps(_mm256_loadu_ps(Y + x - 1), cy), lz = _mm256_sub_ps(_mm256_loadu_ps(Z + x - 1), cz);
+		const __m256 ux = _mm256_sub_ps(_mm256_loadu_ps(UX + x), cx), uy = _mm256_sub_ps(_mm256_loadu_ps(UY + x), cy), uz = _mm256_sub_ps(_mm256_loadu_ps(UZ + x), cz);
+		const __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(DX + x), cx), dy = _mm256_sub_ps(_mm256_loadu_ps(DY + x), cy), dz = _mm256_sub_ps(_mm256_loadu_ps(DZ + x), cz);
+		const __m256 vc = _mm256_cmp_ps(_mm256_loadu_ps(V + x), half, _CMP_GT_OQ);
+		const __m256 vr = _mm256_cmp_ps(_mm256_loadu_ps(V + x + 1), half, _CMP_GT_OQ);
+		const __m256 vl = _mm256_cmp_ps(_mm256_loadu_ps(V + x - 1), half, _CMP_GT_OQ);
+		const __m256 vu = _mm256_cmp_ps(_mm256_loadu_ps(UV + x), half, _CMP_GT_OQ);
+		const __m256 vd = _mm256_cmp_ps(_mm256_loadu_ps(DV + x), half, _CMP_GT_OQ);
+
+		__m256 nx = zero, ny = zero, nz = zero;
+		grid_normal_term_avx2(dx, dy, dz, rx, ry, rz, _mm256_and_ps(vd, vr), area2, nx, ny, nz);
+		grid_normal_term_avx2(lx, ly, lz, dx, dy, dz, _mm256_and_ps(vl, vd), area2, nx, ny, nz);
+		grid_normal_term_avx2(ux, uy, uz, lx, ly, lz, _mm256_and_ps(vu, vl), area2, nx, ny, nz);
+		grid_normal_term_avx2(rx, ry, rz, ux, uy, uz, _mm256_and_ps(vr, vu), area2, nx, ny, nz);
+
+		// normalize, leaving zero where there were no terms or the vertex itself is invalid:
+		const __m256 len2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, nx), _mm256_mul_ps(ny, ny)), _mm256_mul_ps(nz, nz));
+		const __m256 ok = _mm256_and_ps(vc, _mm256_cmp_ps(len2, zero, _CMP_GT_OQ));
+		const __m256 inv = _mm256_and_ps(ok, _mm256_div_ps(_mm256_set1_ps(1.f), _mm256_sqrt_ps(len2)));
+		nx = _mm256_mul_ps(nx, inv);
+		ny = _mm256_mul_ps(ny, inv);
+		nz = _mm256_mul_ps(nz, inv);
+
+		store_xyz8((float *)(normals + x - 1), nx, ny, nz);
+	}
+	for (; x <= width; x++) normals[x - 1] = grid_normal_scalar(rows, x, maxarea2);
+}
+
+#endif // KERNELS_X86
+
+// grid normals for vertex rows [y0, y1) of a width x height grid
+inline void grid_normals_rows(const glm::vec3 * vertices, int width, int height, int y0, int y1, glm::vec3 min, glm::vec3 max, float maxarea, glm::vec3 * normals) {
+	const float maxarea2 = maxarea > 0.f ? maxarea*maxarea : 0.f;
+	GridNormalRows rows(width);
+	rows.load(1, vertices, height, y0 - 1, min, max);
+	rows.load(2, vertices, height, y0, min, max);
+#ifdef KERNELS_X86
+	const bool avx2 = simd_level() == SIMD_AVX2;
+#endif
+	for (int y=y0; y<y1; y++) {
+		// rotate the rows up by one, and load the row below:
+		std::rotate(rows.data.begin(), rows.data.begin() + 4 * (width + 2), rows.data.end());
+		rows.load(2, vertices, height, y + 1, min, max);
+
+		glm::vec3 * out = normals + y*width;
+#ifdef KERNELS_X86
+		if (avx2) {
+			grid_normals_row_avx2(rows, maxarea2, out);
+			continue;
+		}
+#endif
+		for (int x=1; x<=width; x++) out[x - 1] = grid_normal_scalar(rows, x, maxarea2);
+	}
+}
+
+#endif // REALSENSE_KERNELS_H
@@ -0,0 +1,344 @@
+#ifndef REALSENSE_MC_H
+#define REALSENSE_MC_H
+
+/*
+	Marching cubes surface extraction from dense voxel grids, in parallel z slabs.
+
+	Vertices lie on the grid edges that cross the iso level, and each is shared by all the triangles that use
+	it: every vertex belongs to the grid layer its edge starts from, and is numbered by a prefix sum over the
+	layers, so each slab can number vertices independently (keeping the ids of two layers in a rolling edge
+	cache) and still agree with its neighbours. Triangles are wound counter-clockwise seen from outside.
+
+	The triangulation table is generated rather than typed in: the surface's boundary on each cube face cuts
+	off each run of inside corners separately, and the boundary segments are linked into loops and fanned.
+	As the choice on a face depends only on that face's corners, neighbouring cubes agree and the mesh is
+	closed wherever the surface doesn't reach the edge of the grid.
+
+	Usage: prepare() to count the vertices, generate() to write them and collect the triangles, then
+	write_indices() once the index array is large enough.
+*/
+
+#include <stdint.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "al_glm.h"
+#include "threadpool.h"
+
+class MarchingCubes {
+public:
+
+	// Classify the grid (dim.x*dim.y*dim.z, x fastest) and count the vertices the surface will have.
+	// Points are inside the surface where the value is above `iso`, or below it if `inside_below` is set.
+	size_t prepare(const float * field, glm::ivec3 dim, float iso, bool inside_below) {
+		this->field = field;
+		this->dim = dim;
+		this->iso = iso;
+		this->inside_below = inside_below;
+		layer_size = size_t(dim.x) * dim.y;
+
+		ThreadPool& pool = thread_pool();
+		inside.resize(layer_size * std::max(dim.z, 0));
+		layer_offset.assign(std::max(dim.z, 0) + 1, 0);
+		if (dim.x < 2 || dim.y < 2 || dim.z < 2) return 0;
+
+		const int bands = pool.bands_for(dim.z, min_layers(1));
+		pool.parallel_for(bands, [&](int band) {
+			int z0, z1;
+			ThreadPool::band_range(band, bands, dim.z, z0, z1);
+			for (size_t i=z0*layer_size; i<z1*layer_size; i++) {
+				inside[i] = is_inside(field[i]);
+			}
+		});
+
+		// count each layer's crossing edges:
+		pool.parallel_for(bands, [&](int band) {
+			int z0, z1;
+			ThreadPool::band_range(band, bands, dim.z, z0, z1);
+			for (int z=z0; z<z1; z++) layer_offset[z+1] = scan_layer(z, nullptr, nullptr, nullptr, 0);
+		});
+		for (int z=0; z<dim.z; z++) layer_offset[z+1] += layer_offset[z];
+		return layer_offset[dim.z];
+	}
+
+	// Write the vertices (and normals, if not null) and triangulate the cells.
+	// `voxel2world` maps grid coordinates (where voxel i is at i) to the space of the output vertices.
+	// Returns the number of indices.
+	size_t generate(glm::vec3 * vertices, glm::vec3 * normals, const glm::mat4& voxel2world) {
+		const int num_cells_z = dim.z - 1;
+		if (dim.x < 2 || dim.y < 2 || num_cells_z < 1) {
+			slab_triangles.clear();
+			return 0;
+		}
+		this->voxel2world = voxel2world;
+		this->normal_matrix = glm::transpose(glm::inverse(glm::mat3(voxel2world)));
+		const Table& table = get_table();
+
+		ThreadPool& pool = thread_pool();
+		const int slabs = pool.bands_for(num_cells_z, min_layers(2));
+		slab_triangles.resize(slabs);
+		slab_caches.resize(slabs);
+		pool.parallel_for(slabs, [&](int slab) {
+			int c0, c1;
+			ThreadPool::band_range(slab, slabs, num_cells_z, c0, c1);
+			std::vector<uint32_t>& tris = slab_triangles[slab];
+			tris.clear();
+			// ids of the vertices on the 3 edges leaving each point of two layers:
+			std::vector<uint32_t>& cache = slab_caches[slab];
+			cache.resize(layer_size * 3 * 2);
+			uint32_t * prev = &cache[0];
+			uint32_t * curr = &cache[layer_size * 3];
+
+			for (int z=c0; z<=c1; z++) {
+				// vertices are written by the slab that owns their layer
+				// (the top layer of the grid has no cells above it, so it belongs to the last slab):
+				const bool owner = z < c1 || z == dim.z-1;
+				scan_layer(z, curr, owner ? vertices : nullptr, normals, layer_offset[z]);
+				if (z > c0) triangulate_layer(z-1, prev, curr, table, tris);
+				std::swap(prev, curr);
+			}
+		});
+
+		size_t total = 0;
+		slab_start.resize(slabs + 1);
+		for (int slab=0; slab<slabs; slab++) {
+			slab_start[slab] = total;
+			total += slab_triangles[slab].size();
+		}
+		slab_start[slabs] = total;
+		return total;
+	}
+
+	// copy the triangles found by generate()
+	void write_indices(uint32_t * indices) const {
+		const int slabs = int(slab_triangles.size());
+		thread_pool().parallel_for(slabs, [&](int slab) {
+			const std::vector<uint32_t>& tris = slab_triangles[slab];
+			if (!tris.empty()) memcpy(indices + slab_start[slab], tris.data(), tris.size() * sizeof(uint32_t));
+		});
+	}
+
+private:
+
+	enum { MAX_TRIANGLES = 8, MIN_BAND_POINTS = 4096 };
+
+	struct Case {
+		uint8_t num_triangles;
+		uint8_t edges[MAX_TRIANGLES * 3];
+	};
+
+	struct Table {
+		// corner i is at (i&1, (i>>1)&1, (i>>2)&1)
+		// edge e leaves corner edge_corner[e] along axis edge_axis[e]
+		uint8_t edge_corner[12], edge_axis[12];
+		Case cases[256];
+	};
+
+	static const Table& get_table() {
+		static const Table table = make_table();
+		return table;
+	}
+
+	static Table make_table() {
+		Table t;
+		int edge_index[8][8];
+		int e = 0;
+		for (int axis=0; axis<3; axis++) {
+			for (int i=0; i<8; i++) {
+				if (i & (1 << axis)) continue;
+				t.edge_corner[e] = i;
+				t.edge_axis[e] = axis;
+				edge_index[i][i | (1 << axis)] = edge_index[i | (1 << axis)][i] = e;
+				e++;
+			}
+		}
+
+		// the corners of each face, counter-clockwise seen from outside the cube:
+		int faces[6][4];
+		for (int axis=0; axis<3; axis++) {
+			const int u = (axis + 1) % 3, v = (axis + 2) % 3;
+			for (int side=0; side<2; side++) {
+				const int cu[4] = { 0, 1, 1, 0 }, cv[4] = { 0, 0, 1, 1 };
+				int * face = faces[axis*2 + side];
+				for (int k=0; k<4; k++) {
+					// counter-clockwise about +axis; reversed for the face that looks along -axis
+					const int kk = side ? k : 3 - k;
+					face[k] = (side << axis) | (cu[kk] << u) | (cv[kk] << v);
+				}
+			}
+		}
+
+		// which faces each edge lies on, as a bitmask:
+		int edge_faces[12] = { 0 };
+		for (int f=0; f<6; f++) {
+			for (int k=0; k<4; k++) edge_faces[edge_index[faces[f][k]][faces[f][(k+1) % 4]]] |= 1 << f;
+		}
+
+		for (int config=0; config<256; config++) {
+			Case& c = t.cases[config];
+			c.num_triangles = 0;
+
+			// on each face, a segment runs from where the boundary walk enters a run of inside corners
+			// to where it leaves it, which keeps the inside on the right seen from outside the cube:
+			int next[12];
+			for (int i=0; i<12; i++) next[i] = -1;
+			for (int f=0; f<6; f++) {
+				const int * face = faces[f];
+				for (int k=0; k<4; k++) {
+					const int a = face[k], b = face[(k+1) % 4];
+					if ((config >> a & 1) || !(config >> b & 1)) continue;
+					// entering at edge a-b; find where the run of inside corners is left:
+					for (int j=1; j<4; j++) {
+						const int p = face[(k+j) % 4], q = face[(k+j+1) % 4];
+						if ((config >> p & 1) && !(config >> q & 1)) {
+							next[edge_index[a][b]] = edge_index[p][q];
+							break;
+						}
+					}
+				}
+			}
+
+			// link the segments into loops, and fan them into triangles:
+			bool used[12] = { false };
+			for (int start=0; start<12; start++) {
+				if (next[start] < 0 || used[start]) continue;
+				int loop[12], n = 0;
+				for (int edge=start; !used[edge]; edge=next[edge]) {
+					used[edge] = true;
+					loop[n++] = edge;
+				}
+				// fan from a vertex whose diagonals don't run along a cube face, where they could
+				// overlap the triangles of the neighbouring cube:
+				int first = 0;
+				for (int r=0; r<n; r++) {
+					bool ok = true;
+					for (int k=2; k+1<n; k++) {
+						if (edge_faces[loop[r]] & edge_faces[loop[(r+k) % n]]) ok = false;
+					}
+					if (ok) {
+						first = r;
+						break;
+					}
+				}
+				for (int k=1; k+1<n && c.num_triangles < MAX_TRIANGLES; k++) {
+					uint8_t * tri = &c.edges[c.num_triangles++ * 3];
+					tri[0] = loop[first];
+					tri[1] = loop[(first + k) % n];
+					tri[2] = loop[(first + k + 1) % n];
+				}
+			}
+		}
+		return t;
+	}
+
+	// layers per band: at least `n`, and enough that small grids (e.g. single bricks) run on the calling thread
+	int min_layers(int n) const {
+		return std::max(n, int(MIN_BAND_POINTS / std::max(layer_size, size_t(1))));
+	}
+
+	bool is_inside(float value) const {
+		return inside_below ? value < iso : value > iso;
+	}
+
+	// gradient of the field by central differences, at grid point p
+	glm::vec3 gradient(int x, int y, int z) const {
+		const size_t i = z*layer_size + size_t(y)*dim.x + x;
+		const float * f = field;
+		const size_t sx = 1, sy = dim.x, sz = layer_size;
+		return glm::vec3(
+			(x > 0 && x < dim.x-1) ? (f[i+sx] - f[i-sx]) * 0.5f : (x > 0 ? f[i] - f[i-sx] : f[i+sx] - f[i]),
+			(y > 0 && y < dim.y-1) ? (f[i+sy] - f[i-sy]) * 0.5f : (y > 0 ? f[i] - f[i-sy] : f[i+sy] - f[i]),
+			(z > 0 && z < dim.z-1) ? (f[i+sz] - f[i-sz]) * 0.5f : (z > 0 ? f[i] - f[i-sz] : f[i+sz] - f[i]));
+	}
+
+	// Visit the crossing edges leaving each point of layer z, in order, numbering them from `base`.
+	// If `ids` is set, records the id of each edge's vertex; if `out` is set, writes the vertices (& normals).
+	// Returns the number of crossing edges.
+	uint32_t scan_layer(int z, uint32_t * ids, glm::vec3 * out, glm::vec3 * out_normals, uint32_t base) const {
+		uint32_t count = 0;
+		const uint8_t * layer = &inside[z*layer_size];
+		const uint8_t * above = (z < dim.z-1) ? layer + layer_size : nullptr;
+		for (int y=0; y<dim.y; y++) {
+			for (int x=0; x<dim.x; x++) {
+				const size_t i = size_t(y)*dim.x + x;
+				const uint8_t a = layer[i];
+				const bool crosses[3] = {
+					x < dim.x-1 && layer[i+1] != a,
+					y < dim.y-1 && layer[i+dim.x] != a,
+					above && above[i] != a
+				};
+				for (int axis=0; axis<3; axis++) {
+					if (!crosses[axis]) continue;
+					const uint32_t id = base + count++;
+					if (ids) ids[i*3 + axis] = id;
+					if (out) write_vertex(id, x, y, z, axis, out, out_normals);
+				}
+			}
+		}
+		return count;
+	}
+
+	void write_vertex(uint32_t id, int x, int y, int z, int axis, glm::vec3 * out, glm::vec3 * out_normals) const {
+		const glm::ivec3 p0(x, y, z);
+		glm::ivec3 p1 = p0;
+		p1[axis]++;
+		const float v0 = field[p0.z*layer_size + size_t(p0.y)*dim.x + p0.x];
+		const float v1 = field[p1.z*layer_size + size_t(p1.y)*dim.x + p1.x];
+		const float t = (v1 != v0) ? glm::clamp((iso - v0) / (v1 - v0), 0.f, 1.f) : 0.5f;
+		const glm::vec3 pos = glm::mix(glm::vec3(p0), glm::vec3(p1), t);
+		out[id] = glm::vec3(voxel2world * glm::vec4(pos, 1.f));
+		if (out_normals) {
+			// the normal points out of the inside, i.e. down the gradient if inside is above iso
+			glm::vec3 g = glm::mix(gradient(p0.x, p0.y, p0.z), gradient(p1.x, p1.y, p1.z), t);
+			if (!inside_below) g = -g;
+			g = normal_matrix * g;
+			const float len = glm::length(g);
+			out_normals[id] = (len > 0.f) ? g / len : glm::vec3(0.f);
+		}
+	}
+
+	// append the triangles of the cells between layers z and z+1
+	void triangulate_layer(int z, const uint32_t * ids0, const uint32_t * ids1, const Table& table, std::vector<uint32_t>& tris) const {
+		const uint8_t * layer0 = &inside[z*layer_size];
+		const uint8_t * layer1 = layer0 + layer_size;
+		const uint32_t * layer_ids[2] = { ids0, ids1 };
+		for (int y=0; y<dim.y-1; y++) {
+			for (int x=0; x<dim.x-1; x++) {
+				const size_t i = size_t(y)*dim.x + x;
+				const int config = layer0[i] | layer0[i+1] << 1 | layer0[i+dim.x] << 2 | layer0[i+dim.x+1] << 3
+					| layer1[i] << 4 | layer1[i+1] << 5 | layer1[i+dim.x] << 6 | layer1[i+dim.x+1] << 7;
+				// skip cells that are entirely inside or outside:
+				if (config == 0 || config == 255) continue;
+
+				const Case& c = table.cases[config];
+				for (int k=0; k<c.num_triangles*3; k++) {
+					const int e = c.edges[k];
+					const int corner = table.edge_corner[e];
+					const size_t p = i + (corner & 1) + ((corner >> 1) & 1)*dim.x;
+					tris.push_back(layer_ids[(corner >> 2) & 1][p*3 + table.edge_axis[e]]);
+				}
+			}
+		}
+	}
+
+	// the grid being extracted:
+	const float * field = nullptr;
+	glm::ivec3 dim;
+	float iso = 0.f;
+	bool inside_below = false;
+	size_t layer_size = 0;
+
+	// the transform of the output being generated:
+	glm::mat4 voxel2world;
+	glm::mat3 normal_matrix;
+
+	// scratch memory, reused from call to call:
+	std::vector<uint8_t> inside;
+	std::vector<uint32_t> layer_offset;
+	std::vector<std::vector<uint32_t> > slab_triangles, slab_caches;
+	std::vector<size_t> slab_start;
+};
+
+#endif // REALSENSE_MC_H
@@ -4,14 +4,28 @@
 #include <assert.h>
 #include <stdio.h> 
 #include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <mutex>
+#include <string>
 #include <thread>
 #include <vector>
 
 
 #include <librealsense2/rs.hpp> // Include RealSense Cross Platform API
+#include <librealsense2/rsutil.h> // rs2_deproject_pixel_to_point
 
 #include "al_glm.h"
+#include "bufferpool.h"
+#include "kernels.h"
+#include "threadpool.h"
+#include "voxels.h"
+#include "volume.h"
+#include "tsdf.h"
+#include "mc.h"
+#include "sync.h"
 
 // Euclidean modulo. assumes n > 0
 int wrap(int a, int n) { 
@@ -19,6 +33,316 @@ int wrap(int a, int n) {
 	return r < 0 ? r + n : r; //a % n + (Math.sign(a) !== Math.sign(n) ? n : 0); 
 }
 
+// finalizer of pooled_array's buffers
+static void release_pooled(napi_env env, void * data, void * hint) {
+	buffer_pool().release(data);
+}
+
+// A typed array over pooled, aligned native memory (see bufferpool.h), wrapped as an external ArrayBuffer
+// so that frames are processed straight into memory that JS (and GL uploads) can read.
+// The memory goes back to the pool when JS garbage-collects the ArrayBuffer.
+template<typename T>
+Napi::TypedArrayOf<T> pooled_array(Napi::Env env, size_t length, napi_typedarray_type type) {
+	const size_t bytes = std::max(length, size_t(1)) * sizeof(T);
+	void * data = buffer_pool().acquire(bytes);
+	if (!data) return Napi::TypedArrayOf<T>::New(env, length, type);
+	// some runtimes (e.g. Electron with the V8 sandbox) refuse external buffers, so fall back to a plain array:
+	napi_value buffer;
+	if (napi_create_external_arraybuffer(env, data, bytes, release_pooled, nullptr, &buffer) != napi_ok) {
+		buffer_pool().release(data);
+		return Napi::TypedArrayOf<T>::New(env, length, type);
+	}
+	return Napi::TypedArrayOf<T>::New(env, length, Napi::ArrayBuffer(env, buffer), 0, type);
+}
+
+// The typed array `name` of `result` if it holds at least `length` elements, otherwise a new (pooled) one 
+// with some room to grow, which is set on `result`. For outputs that JS passes back in to be reused. 
+template<typename T>
+Napi::TypedArrayOf<T> reusable_array(Napi::Env env, Napi::Object result, const char * name, size_t length, napi_typedarray_type type) {
+	Napi::Value current = result.Get(name);
+	if (current.IsTypedArray() && current.As<Napi::TypedArray>().TypedArrayType() == type 
+		&& current.As<Napi::TypedArrayOf<T> >().ElementLength() >= length) {
+		return current.As<Napi::TypedArrayOf<T> >();
+	}
+	Napi::TypedArrayOf<T> array = pooled_array<T>(env, length + length/4 + 64, type);
+	result.Set(name, array);
+	return array;
+}
+
+// Run marching cubes (already prepared with num_vertices) into the arrays of `result`, 
+// which become { vertices, normals, indices, vertexcount, count } with `count` indices of triangles. 
+Napi::Object march_result(Napi::Env env, MarchingCubes& mc, size_t num_vertices, const glm::mat4& voxel2world, Napi::Object result) {
+	Napi::Float32Array vertices = reusable_array<float>(env, result, "vertices", num_vertices * 3, napi_float32_array);
+	Napi::Float32Array normals = reusable_array<float>(env, result, "normals", num_vertices * 3, napi_float32_array);
+	const size_t num_indices = mc.generate((glm::vec3 *)vertices.Data(), (glm::vec3 *)normals.Data(), voxel2world);
+	Napi::Uint32Array indices = reusable_array<uint32_t>(env, result, "indices", num_indices, napi_uint32_array);
+	mc.write_indices(indices.Data());
+	result.Set("vertexcount", Napi::Number::New(env, num_vertices));
+	result.Set("count", Napi::Number::New(env, num_indices));
+	return result;
+}
+
+// a snapshot of the JS-side processing parameters, so that frames can be processed away from the main thread
+struct CloudParams {
+	glm::mat4 transform = glm::mat4();
+	glm::vec3 min = glm::vec3(-10, -10, -10); 
+	glm::vec3 max = glm::vec3(10, 10, 10);
+	float maxarea = 0.001;
+	// Z16 downsampling before deprojection (see downsample_z16_rows)
+	int downsample = 1;
+	bool median = false;
+	// temporal Z16 smoothing (see smooth_z16), off while alpha is 0; threshold in meters, persistence in frames
+	float smooth_alpha = 0.f;
+	float smooth_threshold = 0.05f;
+	int smooth_persistence = 3;
+	// flying pixel rejection for point clouds (see reject_flying_z16), off while 0
+	float edge = 0.f;
+};
+
+// A chain of librealsense post-processing blocks, run on depth frames before deprojection. 
+// The blocks are made once, as some keep state from frame to frame (e.g. the temporal filter), 
+// and the chain is only ever run by whichever thread is processing the camera's frames. 
+struct FilterChain {
+	std::vector<rs2::filter> blocks;
+	// name of each stage, for the timings
+	std::vector<std::string> names;
+
+	bool empty() const { return blocks.empty(); }
+
+	// Run the chain, writing the time each stage took (ms) into `times`.
+	// Returns the input unchanged if there are no stages. 
+	rs2::depth_frame apply(const rs2::depth_frame& depth, std::vector<float>& times) {
+		times.resize(blocks.size());
+		if (blocks.empty() || !depth) return depth;
+		rs2::frame frame = depth;
+		for (size_t i=0; i<blocks.size(); i++) {
+			const auto t0 = std::chrono::steady_clock::now();
+			frame = blocks[i].process(frame);
+			times[i] = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - t0).count();
+		}
+		return frame.as<rs2::depth_frame>();
+	}
+
+	// Build the chain from an array of stages, each a name or { type, ...options }, in the order given: 
+	// 	"decimation" { magnitude: 2 }
+	// 	"threshold" { min: 0.15, max: 4 }
+	// 	"spatial" { alpha: 0.5, delta: 20, magnitude: 2, holes: 0 }
+	// 	"temporal" { alpha: 0.4, delta: 20, persistence: 3 }
+	// 	"holes" { mode: 1 }
+	// Spatial & temporal filtering works best on disparity, so conversions to & from disparity are added around them. 
+	// Throws a JS exception and returns false if a stage is not understood. 
+	bool configure(Napi::Env env, const Napi::Value& value) {
+		blocks.clear();
+		names.clear();
+		if (value.IsUndefined() || value.IsNull()) return true;
+		if (!value.IsArray()) {
+			Napi::TypeError::New(env, "filters expects an array of filter stages").ThrowAsJavaScriptException();
+			return false;
+		}
+		// the options each type of stage accepts 
+		// (librealsense reuses HOLES_FILL for the spatial hole filling, the temporal persistence and the hole filling mode):
+		static const struct { const char * type; const char * key; rs2_option option; } option_keys[] = {
+			{ "decimation", "magnitude", RS2_OPTION_FILTER_MAGNITUDE },
+			{ "threshold", "min", RS2_OPTION_MIN_DISTANCE },
+			{ "threshold", "max", RS2_OPTION_MAX_DISTANCE },
+			{ "spatial", "alpha", RS2_OPTION_FILTER_SMOOTH_ALPHA },
+			{ "spatial", "delta", RS2_OPTION_FILTER_SMOOTH_DELTA },
+			{ "spatial", "magnitude", RS2_OPTION_FILTER_MAGNITUDE },
+			{ "spatial", "holes", RS2_OPTION_HOLES_FILL },
+			{ "temporal", "alpha", RS2_OPTION_FILTER_SMOOTH_ALPHA },
+			{ "temporal", "delta", RS2_OPTION_FILTER_SMOOTH_DELTA },
+			{ "temporal", "persistence", RS2_OPTION_HOLES_FILL },
+			{ "holes", "mode", RS2_OPTION_HOLES_FILL },
+		};
+
+		Napi::Array stages = value.As<Napi::Array>();
+		bool disparity = false;
+		for (uint32_t i=0; i<stages.Length(); i++) {
+			Napi::Value stage = stages.Get(i);
+			Napi::Object options = stage.IsObject() ? stage.ToObject() : Napi::Object::New(env);
+			const std::string type = stage.IsObject() ? options.Get("type").ToString().Utf8Value() : stage.ToString().Utf8Value();
+
+			const bool smoothing = (type == "spatial" || type == "temporal");
+			if (smoothing != disparity) {
+				blocks.push_back(rs2::disparity_transform(smoothing));
+				names.push_back(smoothing ? "disparity" : "depth");
+				disparity = smoothing;
+			}
+
+			rs2::filter block;
+			if (type == "decimation") block = rs2::decimation_filter();
+			else if (type == "threshold") block = rs2::threshold_filter();
+			else if (type == "spatial") block = rs2::spatial_filter();
+			else if (type == "temporal") block = rs2::temporal_filter();
+			else if (type == "holes") block = rs2::hole_filling_filter();
+			else {
+				blocks.clear();
+				names.clear();
+				Napi::TypeError::New(env, "unknown filter type: " + type).ThrowAsJavaScriptException();
+				return false;
+			}
+
+			for (const auto& k : option_keys) {
+				if (type != k.type || !options.Has(k.key) || !block.supports(k.option)) continue;
+				try {
+					block.set_option(k.option, options.Get(k.key).ToNumber().FloatValue());
+				} catch (const rs2::error& e) {
+					blocks.clear();
+					names.clear();
+					Napi::RangeError::New(env, type + " filter " + k.key + ": " + e.what()).ThrowAsJavaScriptException();
+					return false;
+				}
+			}
+			blocks.push_back(block);
+			names.push_back(type);
+		}
+		if (disparity) {
+			blocks.push_back(rs2::disparity_transform(false));
+			names.push_back("depth");
+		}
+		return true;
+	}
+};
+
+// output storage for one processed point cloud
+// the typed arrays are held by persistent references, so that their memory can be written from a worker thread
+struct CloudBuffer {
+	Napi::Reference<Napi::Float32Array> vertices_ref;
+	Napi::Reference<Napi::Uint32Array> indices_ref;
+	glm::vec3 * vertices = nullptr;
+	uint32_t * indices = nullptr;
+	// max number of points that fit in the buffer
+	size_t capacity = 0;
+
+	// results of the last frame written:
+	int width = 0, height = 0;
+	uint32_t count = 0;
+	// device timestamp of the depth frame, and host time when processing began (both in ms)
+	// with global time enabled, the difference is the sensor-to-host latency
+	double timestamp = 0;
+	double received = 0;
+	bool has_accel = false;
+	glm::vec3 accel;
+	// the depth intrinsics and the transform the vertices were made with
+	// (so that the depth of each pixel can be recovered, e.g. for TSDF fusion)
+	rs2_intrinsics intrin;
+	glm::mat4 transform;
+	// time spent in each stage of the filter chain (ms)
+	std::vector<float> filter_times;
+
+	void allocate(Napi::Env env, size_t num_vertices) {
+		Napi::Float32Array v = pooled_array<float>(env, num_vertices * 3, napi_float32_array);
+		Napi::Uint32Array i = pooled_array<uint32_t>(env, num_vertices, napi_uint32_array);
+		vertices_ref = Napi::Persistent(v);
+		indices_ref = Napi::Persistent(i);
+		vertices = (glm::vec3 *)v.Data();
+		indices = i.Data();
+		capacity = num_vertices;
+		count = 0;
+	}
+};
+
+// the intrinsics of an image downsampled by `factor`, whose pixels sit at the centers of the original blocks
+rs2_intrinsics downsample_intrinsics(rs2_intrinsics intrin, int factor) {
+	intrin.width /= factor;
+	intrin.height /= factor;
+	intrin.ppx = (intrin.ppx - 0.5f*(factor - 1)) / factor;
+	intrin.ppy = (intrin.ppy - 0.5f*(factor - 1)) / factor;
+	intrin.fx /= factor;
+	intrin.fy /= factor;
+	return intrin;
+}
+
+// Per-pixel rays of the depth stream, so that deprojection becomes a multiply per pixel.
+// Each ray is the xy of the deprojected point at depth 1 (in the intel frame, y down, z forward),
+// including any lens distortion model. x and y are stored as separate arrays for the SIMD kernels.
+// The table is only rebuilt when the stream intrinsics change.
+struct RayTable {
+	rs2_intrinsics intrin;
+	std::vector<float> rx, ry;
+
+	void update(const rs2_intrinsics& in) {
+		const size_t num_pixels = in.width * in.height;
+		if (rx.size() == num_pixels && memcmp(&in, &intrin, sizeof(rs2_intrinsics)) == 0) return;
+
+		intrin = in;
+		rx.resize(num_pixels);
+		ry.resize(num_pixels);
+		for (int y=0; y<in.height; y++) {
+			for (int x=0; x<in.width; x++) {
+				// same pixel convention as rs2::pointcloud
+				const float pixel[2] = { float(x), float(y) };
+				float point[3];
+				rs2_deproject_pixel_to_point(point, &intrin, pixel, 1.f);
+				rx[y*in.width + x] = point[0];
+				ry[y*in.width + x] = point[1];
+			}
+		}
+	}
+};
+
+enum NormalsMode {
+	NORMALS_NONE = 0,
+	NORMALS_FACES,
+	NORMALS_GRID
+};
+
+// After row bands have each written their indices starting at their own first pixel,
+// a prefix sum over the band counts packs the lists together, keeping them in scan order.
+// Each band only moves to the left, and never over a band that hasn't moved yet.
+// Returns the total count.
+uint32_t pack_bands(uint32_t * indices, const std::vector<uint32_t>& band_counts, int rows, int row_size) {
+	const int bands = band_counts.size();
+	uint32_t index_count = 0;
+	for (int band=0; band<bands; band++) {
+		int y0, y1;
+		ThreadPool::band_range(band, bands, rows, y0, y1);
+		const uint32_t * band_indices = indices + y0*row_size;
+		if (indices + index_count != band_indices) {
+			memmove(indices + index_count, band_indices, band_counts[band] * sizeof(uint32_t));
+		}
+		index_count += band_counts[band];
+	}
+	return index_count;
+}
+
+// Lock-free triple buffer for handing the latest frame from one writer thread to one reader thread
+// The writer always owns the `back` slot, the reader owns the `front` slot, and the third slot is `shared`. 
+// Publishing & acquiring are single atomic exchanges, so neither side ever blocks the other. 
+// A slow reader simply skips over stale frames. 
+struct TripleBuffer {
+	// bit set in `shared` when it holds a frame the reader has not yet seen:
+	static const int FRESH = 4;
+	static const int INDEX_MASK = 3;
+
+	std::atomic<int> shared { 2 };
+	int back = 0;	// only touched by writer
+	int front = 1;	// only touched by reader
+
+	// writer: hand over the back slot, and take whichever slot was shared
+	void publish() {
+		back = shared.exchange(back | FRESH) & INDEX_MASK;
+	}
+
+	// reader: if a new frame was published, swap it into front
+	// returns false if there was nothing new
+	bool acquire() {
+		if (!(shared.load() & FRESH)) return false;
+		front = shared.exchange(front) & INDEX_MASK;
+		return true;
+	}
+
+	void reset() {
+		shared = 2;
+		back = 0;
+		front = 1;
+	}
+};
+
+// Camera objects are tagged on construction, so that other wrapped objects (VoxelVolume etc.) can never be unwrapped as one
+// (see unwrap_camera)
+static const napi_type_tag CAMERA_TYPE_TAG = { 0x7c1e5a9d3b2f4e61ULL, 0xa4d8203f6b95c17eULL };
+
  struct Camera : public Napi::ObjectWrap<Camera> {
 
 	// Create a Pipeline - this serves as a top-level API for streaming and processing frames
@@ -31,10 +355,50 @@ int wrap(int a, int n) {
 	// We want the points object to be persistent so we can display the last cloud when a frame drops
 	// https://intelrealsense.github.io/librealsense/doxygen/classrs2_1_1points.html
 	rs2::points points;
-
+	// used instead of `pc` for the point pipeline of grab(), grabAsync() and onFrame():
+	RayTable ray_table;
+	// the Z16 image after downsampling, when enabled:
+	std::vector<uint16_t> downsampled;
+	// per-pixel state of temporal smoothing, when enabled (the smoothed depth, and the frames each pixel has been missing):
+	std::vector<uint16_t> smooth_state, smooth_missing;
+	// which triangles of each quad grabMesh() kept:
+	std::vector<uint8_t> quad_mask;
+
+	// Processing parameters are native: `modelmatrix`, `min` and `max` are typed arrays owned by the camera, 
+	// which JS may modify in place (e.g. with gl-matrix), and the hot path reads them through cached pointers 
+	// instead of looking up JS properties each frame. 
+	// Assigning to them copies the values in. 
+	Napi::Reference<Napi::Float32Array> modelmatrix_ref, min_ref, max_ref;
+	float * modelmatrix_data = nullptr;
 	// min & max bounds for mesh & voxel processing (world space)
-	glm::vec3 min = glm::vec3(-10, -10, -10); 
-	glm::vec3 max = glm::vec3(10, 10, 10);
+	float * min_data = nullptr;
+	float * max_data = nullptr;
+	float maxarea = 0.001;
+	int downsample = 1;
+	bool downsample_median = false;
+	float smooth_alpha = 0.f, smooth_threshold = 0.05f;
+	int smooth_persistence = 3;
+	float edge = 0.f;
+	// the last values seen, and whether they have changed since being handed to the processing thread:
+	CloudParams current_params;
+	bool params_dirty = true;
+
+	// depth post-processing, applied by whichever thread processes the frames
+	// (so it can only be changed while no other thread is processing)
+	FilterChain filters;
+
+	// scratch memory for voxels():
+	VoxelSplatter splatter;
+
+	// results of the last frame, read by the width/height/count/timestamp/received/filterTimes accessors:
+	struct {
+		int width = 0, height = 0;
+		uint32_t count = 0;
+		double timestamp = 0, received = 0;
+		rs2_intrinsics intrin;
+		glm::mat4 transform;
+		std::vector<float> filter_times;
+	} results;
 
 	// storage for the vertex xyz points
 	Napi::ArrayBuffer vertices_ab;
@@ -43,7 +407,35 @@ int wrap(int a, int n) {
 	Napi::TypedArrayOf<float> vertices;
 	Napi::TypedArrayOf<float> normals;
 	Napi::TypedArrayOf<uint32_t> indices;
-	Napi::TypedArrayOf<float> accel;
+	Napi::Reference<Napi::Float32Array> accel_ref;
+	float * accel = nullptr;
+
+	// opt-in background capture:
+	// a worker thread pulls framesets and runs the full point pipeline into one of the slots,
+	// so that grab() on the main thread only needs to swap buffers
+	std::thread capture_thread;
+	std::atomic<bool> capturing { false };
+	CloudBuffer slots[3];
+	TripleBuffer triple;
+	// parameters are snapshotted on the main thread (see share_params) and read by the capture thread:
+	std::mutex params_mutex;
+	CloudParams params;
+	std::atomic<bool> params_changed { true };
+	// the processing thread's copy:
+	CloudParams current;
+
+	// true while a grabAsync() is in flight
+	bool async_pending = false;
+
+	// event-driven capture via onFrame(): 
+	// processed frames are published through the same triple buffer, and delivered to JS through a threadsafe function
+	bool started = false;
+	bool listening = false;
+	Napi::ThreadSafeFunction tsfn;
+	std::atomic<bool> delivery_pending { false };
+	// accel arrives in separate frames in callback mode (guarded by params_mutex):
+	glm::vec3 motion_accel;
+	bool has_motion_accel = false;
 
 // 	// .getWidth(), .getHeight(), .getResolution(), .getChannels()
 // 	// .getDataType(), .getMemoryType() (CPU or GPU), .getPtr()
@@ -59,17 +451,134 @@ int wrap(int a, int n) {
     Camera(const Napi::CallbackInfo& info) : Napi::ObjectWrap<Camera>(info) {
 		Napi::Env env = info.Env();
 		Napi::Object This = info.This().As<Napi::Object>();
+		napi_type_tag_object(env, This, &CAMERA_TYPE_TAG);
 
-
-		accel = Napi::TypedArrayOf<float>::New(env, 3, napi_float32_array);
-		This.Set("accel", accel);
+		Napi::Float32Array accel_array = Napi::Float32Array::New(env, 3, napi_float32_array);
+		accel_ref = Napi::Persistent(accel_array);
+		accel = accel_array.Data();
+		This.Set("accel", accel_array);
 		accel[0] = 0;
 		accel[1] = 0;
 		accel[2] = -10;
 
+		modelmatrix_data = own_array(env, modelmatrix_ref, 16);
+		glm::mat4 identity(1.f);
+		memcpy(modelmatrix_data, glm::value_ptr(identity), sizeof(identity));
+		min_data = own_array(env, min_ref, 3);
+		max_data = own_array(env, max_ref, 3);
+		for (int i=0; i<3; i++) {
+			min_data[i] = current_params.min[i];
+			max_data[i] = current_params.max[i];
+		}
+
 		if (info.Length()) start(info);
 	}
 
+	// create a Float32Array owned by the camera, returning its data
+	static float * own_array(Napi::Env env, Napi::Reference<Napi::Float32Array>& ref, size_t size) {
+		Napi::Float32Array array = Napi::Float32Array::New(env, size, napi_float32_array);
+		ref = Napi::Persistent(array);
+		return array.Data();
+	}
+
+	// copy an array-like JS value into one of the camera's own arrays
+	static void copy_array(const Napi::Value& value, float * data, size_t size) {
+		if (value.IsTypedArray() && value.As<Napi::TypedArray>().TypedArrayType() == napi_float32_array) {
+			Napi::Float32Array src = value.As<Napi::Float32Array>();
+			memcpy(data, src.Data(), std::min(size, src.ElementLength()) * sizeof(float));
+		} else if (value.IsObject()) {
+			const Napi::Object src = value.ToObject();
+			for (uint32_t i=0; i<size; i++) data[i] = src.Get(i).ToNumber().FloatValue();
+		}
+	}
+
+	Napi::Value get_modelmatrix(const Napi::CallbackInfo& info) { return modelmatrix_ref.Value(); }
+	void set_modelmatrix(const Napi::CallbackInfo& info, const Napi::Value& value) { copy_array(value, modelmatrix_data, 16); }
+	Napi::Value get_min(const Napi::CallbackInfo& info) { return min_ref.Value(); }
+	void set_min(const Napi::CallbackInfo& info, const Napi::Value& value) { copy_array(value, min_data, 3); }
+	Napi::Value get_max(const Napi::CallbackInfo& info) { return max_ref.Value(); }
+	void set_max(const Napi::CallbackInfo& info, const Napi::Value& value) { copy_array(value, max_data, 3); }
+	Napi::Value get_maxarea(const Napi::CallbackInfo& info) { return Napi::Number::New(info.Env(), maxarea); }
+	void set_maxarea(const Napi::CallbackInfo& info, const Napi::Value& value) { maxarea = value.ToNumber().FloatValue(); }
+
+	// downsample: 1, 2, 4 or 8 reduces the depth image by that factor in each direction before deprojection
+	// (so `vertices` & `indices` are sized to the reduced grid, and `width` & `height` give its size)
+	// downsampleMode: "min" keeps the nearest valid depth of each block, "median" the median of its valid depths
+	Napi::Value get_downsample(const Napi::CallbackInfo& info) { return Napi::Number::New(info.Env(), downsample); }
+	void set_downsample(const Napi::CallbackInfo& info, const Napi::Value& value) {
+		const int factor = value.ToNumber().Int32Value();
+		if (factor != 1 && factor != 2 && factor != 4 && factor != 8) {
+			Napi::RangeError::New(info.Env(), "downsample must be 1, 2, 4 or 8").ThrowAsJavaScriptException();
+			return;
+		}
+		downsample = factor;
+	}
+	Napi::Value get_downsample_mode(const Napi::CallbackInfo& info) { return Napi::String::New(info.Env(), downsample_median ? "median" : "min"); }
+	void set_downsample_mode(const Napi::CallbackInfo& info, const Napi::Value& value) {
+		const std::string mode = value.ToString().Utf8Value();
+		if (mode != "min" && mode != "median") {
+			Napi::TypeError::New(info.Env(), "downsampleMode must be \"min\" or \"median\"").ThrowAsJavaScriptException();
+			return;
+		}
+		downsample_median = (mode == "median");
+	}
+
+	// edge: drop points whose depth jumps from a neighbouring pixel's by more than this fraction of their distance (0 to disable)
+	// this removes the "flying pixels" that streak between foreground edges and the background, as the point indices are built
+	// (points either side of a jump are dropped; grabMesh() is not affected, as maxarea does this for triangles)
+	Napi::Value get_edge(const Napi::CallbackInfo& info) { return Napi::Number::New(info.Env(), edge); }
+	void set_edge(const Napi::CallbackInfo& info, const Napi::Value& value) { edge = std::min(std::max(value.ToNumber().FloatValue(), 0.f), 0.999f); }
+
+	// smoothing: false, or { alpha: 0.4, threshold: 0.05, persistence: 3 } to smooth the depth over time before deprojection
+	// alpha is the weight of each new reading, threshold (meters) the change beyond which a pixel jumps rather than smooths, 
+	// and persistence how many frames a pixel keeps its last depth when it has no reading (see smooth_z16)
+	Napi::Value get_smoothing(const Napi::CallbackInfo& info) {
+		Napi::Env env = info.Env();
+		if (smooth_alpha <= 0.f) return Napi::Boolean::New(env, false);
+		Napi::Object smoothing = Napi::Object::New(env);
+		smoothing.Set("alpha", Napi::Number::New(env, smooth_alpha));
+		smoothing.Set("threshold", Napi::Number::New(env, smooth_threshold));
+		smoothing.Set("persistence", Napi::Number::New(env, smooth_persistence));
+		return smoothing;
+	}
+	void set_smoothing(const Napi::CallbackInfo& info, const Napi::Value& value) {
+		if (!value.IsObject()) {
+			smooth_alpha = value.ToBoolean() ? 0.4f : 0.f;
+			return;
+		}
+		const Napi::Object options = value.ToObject();
+		smooth_alpha = options.Has("alpha") ? std::min(std::max(options.Get("alpha").ToNumber().FloatValue(), 0.f), 1.f) : 0.4f;
+		if (options.Has("threshold")) smooth_threshold = options.Get("threshold").ToNumber().FloatValue();
+		if (options.Has("persistence")) smooth_persistence = options.Get("persistence").ToNumber().Int32Value();
+	}
+
+	Napi::Value get_width(const Napi::CallbackInfo& info) { return Napi::Number::New(info.Env(), results.width); }
+	Napi::Value get_height(const Napi::CallbackInfo& info) { return Napi::Number::New(info.Env(), results.height); }
+	Napi::Value get_count(const Napi::CallbackInfo& info) { return Napi::Number::New(info.Env(), results.count); }
+	Napi::Value get_timestamp(const Napi::CallbackInfo& info) { return Napi::Number::New(info.Env(), results.timestamp); }
+	Napi::Value get_received(const Napi::CallbackInfo& info) { return Napi::Number::New(info.Env(), results.received); }
+
+	// filters: the stages of the depth filter chain (see FilterChain::configure)
+	// reading it gives the stage names, including the disparity conversions
+	Napi::Value get_filters(const Napi::CallbackInfo& info) {
+		Napi::Array names = Napi::Array::New(info.Env(), filters.names.size());
+		for (uint32_t i=0; i<filters.names.size(); i++) names[i] = Napi::String::New(info.Env(), filters.names[i]);
+		return names;
+	}
+	void set_filters(const Napi::CallbackInfo& info, const Napi::Value& value) {
+		if (streaming() || async_pending) {
+			Napi::Error::New(info.Env(), "filters can't be changed during threaded, onFrame or grabAsync capture").ThrowAsJavaScriptException();
+			return;
+		}
+		filters.configure(info.Env(), value);
+	}
+	// time taken by each filter stage for the last frame (ms), in the order of `filters`
+	Napi::Value get_filter_times(const Napi::CallbackInfo& info) {
+		Napi::Array times = Napi::Array::New(info.Env(), results.filter_times.size());
+		for (uint32_t i=0; i<results.filter_times.size(); i++) times[i] = Napi::Number::New(info.Env(), results.filter_times[i]);
+		return times;
+	}
+
 	Napi::Value start(const Napi::CallbackInfo& info) {
 		Napi::Env env = info.Env();
 		Napi::Object This = info.This().As<Napi::Object>();
@@ -90,20 +599,394 @@ int wrap(int a, int n) {
 			This.Set("serial", options.Get("serial"));
 		} 
 
-		config.enable_stream(RS2_STREAM_ACCEL, RS2_FORMAT_MOTION_XYZ32F);
+		if (options.Has("file")) {
+			// play back a recorded .bag file instead of a live device
+			// (recordings may not include the motion streams, so only depth is requested)
+			printf("open file %s\n", options.Get("file").ToString().Utf8Value().c_str());
+			config.enable_device_from_file(options.Get("file").ToString().Utf8Value());
+		} else {
+			config.enable_stream(RS2_STREAM_ACCEL, RS2_FORMAT_MOTION_XYZ32F);
+		}
 		config.enable_stream(RS2_STREAM_DEPTH, width, height, RS2_FORMAT_Z16, fps);
 
+		if (options.Has("filters") && !filters.configure(env, options.Get("filters"))) return env.Null();
+
 		// Configure and start the pipeline
-		p.start(config);
+		rs2::pipeline_profile profile = p.start(config);
+		started = true;
+
+		// with {threaded: true}, frames are processed on a background thread
+		// note that grab() then swaps `vertices` and `indices` for new typed arrays, 
+		// so read them from the camera after each grab rather than holding on to them
+		if (options.Has("threaded") && options.Get("threaded").ToBoolean()) {
+			allocate_slots(env, This, profile);
+			params = get_params();
+			params_changed = true;
+			capturing = true;
+			capture_thread = std::thread(&Camera::capture_loop, this);
+		}
 
 		return This;
 	}
 
+	// preallocate the output slots for threaded or callback capture, from the negotiated depth resolution
+	void allocate_slots(Napi::Env env, Napi::Object This, const rs2::pipeline_profile& profile) {
+		rs2::video_stream_profile depth_profile = profile.get_stream(RS2_STREAM_DEPTH).as<rs2::video_stream_profile>();
+		const size_t num_vertices = depth_profile.width() * depth_profile.height();
+		for (int i=0; i<3; i++) slots[i].allocate(env, num_vertices);
+		triple.reset();
+
+		results.width = depth_profile.width();
+		results.height = depth_profile.height();
+		results.count = 0;
+		this->vertices = slots[triple.front].vertices_ref.Value();
+		this->indices = slots[triple.front].indices_ref.Value();
+		This.Set("vertices", this->vertices);
+		This.Set("indices", this->indices);
+	}
+
+	// true if frames are being processed off the main thread, by the capture thread or by onFrame callbacks
+	bool streaming() const {
+		return capture_thread.joinable() || listening;
+	}
+
+	Napi::Value stop(const Napi::CallbackInfo& info) {
+		// a grabAsync() worker may be waiting on the pipeline:
+		if (async_pending) {
+			Napi::Error::New(info.Env(), "stop() can't be called while grabAsync is in progress").ThrowAsJavaScriptException();
+			return info.Env().Null();
+		}
+		stop_capture();
+		if (listening) {
+			stop_listening();
+		} else if (started) {
+			p.stop();
+		}
+		started = false;
+		return info.This();
+	}
+
+	void stop_capture() {
+		if (capture_thread.joinable()) {
+			capturing = false;
+			capture_thread.join();
+		}
+	}
+
 	~Camera() {
 		//zed_close();
+		stop_capture();
 		printf("~Camera\n");
 	}
 
+	// onFrame(callback) restarts the pipeline in callback mode: 
+	// frames are processed on the librealsense thread as they arrive, and the camera is passed to callback(camera) on the main thread. 
+	// If JS is slower than the camera, intermediate frames are dropped and only the newest is delivered. 
+	// As with threaded capture, `vertices` and `indices` are swapped for each frame. 
+	// Call stop() to end streaming.
+	Napi::Value onFrame(const Napi::CallbackInfo& info) {
+		Napi::Env env = info.Env();
+		Napi::Object This = info.This().As<Napi::Object>();
+
+		if (info.Length() < 1 || !info[0].IsFunction()) {
+			Napi::TypeError::New(env, "onFrame expects a callback function").ThrowAsJavaScriptException();
+			return env.Null();
+		}
+		if (async_pending) {
+			Napi::Error::New(env, "onFrame can't be called while grabAsync is in progress").ThrowAsJavaScriptException();
+			return env.Null();
+		}
+
+		stop_capture();
+		if (listening) {
+			stop_listening();
+		} else if (started) {
+			p.stop();
+		}
+
+		// size the slots before any callback can fire:
+		allocate_slots(env, This, config.resolve(p));
+		params = get_params();
+		params_changed = true;
+		has_motion_accel = false;
+
+		// keep the camera alive while the device can call back into it, and until the last queued call has run
+		// (the finalizer runs after the function is released and its queue has drained):
+		Ref();
+		tsfn = Napi::ThreadSafeFunction::New(env, info[0].As<Napi::Function>(), "onFrame", 0, 1, [this](Napi::Env) {
+			Unref();
+		});
+		delivery_pending = false;
+		listening = true;
+		p.start(config, [this](rs2::frame frame) { 
+			on_frame(frame); 
+		});
+		started = true;
+
+		return This;
+	}
+
+	void stop_listening() {
+		// stopping the pipeline waits for any running callback to finish
+		p.stop();
+		listening = false;
+		// calls still queued see `listening` cleared and return; the finalizer then lets the camera go
+		tsfn.Release();
+	}
+
+	// runs on a librealsense thread:
+	void on_frame(const rs2::frame& frame) {
+		try {
+			// motion frames are not synchronized with depth, so they arrive separately:
+			if (rs2::motion_frame accel_frame = frame.as<rs2::motion_frame>()) {
+				rs2_vector a = accel_frame.get_motion_data();
+				std::lock_guard<std::mutex> lock(params_mutex);
+				motion_accel = glm::vec3(a.x, a.y, a.z);
+				has_motion_accel = true;
+				return;
+			}
+
+			if (params_changed.exchange(false)) {
+				std::lock_guard<std::mutex> lock(params_mutex);
+				current = params;
+			}
+
+			CloudBuffer& out = slots[triple.back];
+			bool ok = false;
+			if (rs2::frameset frames = frame.as<rs2::frameset>()) {
+				ok = process(frames, current, out);
+			} else if (rs2::depth_frame depth = frame.as<rs2::depth_frame>()) {
+				out.has_accel = false;
+				ok = process_depth(filters.apply(depth, out.filter_times), current, out);
+			}
+			if (!ok) return;
+			triple.publish();
+
+			// coalesce: only queue a call into JS if one isn't already waiting
+			if (!delivery_pending.exchange(true)) {
+				if (tsfn.NonBlockingCall([this](Napi::Env env, Napi::Function callback) { 
+					deliver(env, callback); 
+				}) != napi_ok) {
+					delivery_pending = false;
+				}
+			}
+		} catch (const rs2::error& e) {
+			printf("frame callback error: %s\n", e.what());
+		}
+	}
+
+	// runs on the main thread, queued by on_frame():
+	void deliver(Napi::Env env, Napi::Function callback) {
+		// clear first, so that a frame published after this point queues another call
+		delivery_pending = false;
+		if (!listening || !triple.acquire()) return;
+
+		Napi::Object This = Value().As<Napi::Object>();
+		CloudBuffer& front = slots[triple.front];
+		this->vertices = front.vertices_ref.Value();
+		this->indices = front.indices_ref.Value();
+		This.Set("vertices", this->vertices);
+		This.Set("indices", this->indices);
+		set_results(env, This, front);
+
+		// hand over any parameter changes made by JS since the last frame:
+		share_params();
+		{
+			// pick up the latest accel
+			std::lock_guard<std::mutex> lock(params_mutex);
+			if (has_motion_accel) {
+				accel[0] = motion_accel.x;
+				accel[1] = motion_accel.y;
+				accel[2] = motion_accel.z;
+			}
+		}
+
+		callback.Call(This, { This });
+	}
+
+	// runs on the capture thread:
+	void capture_loop() {
+		while (capturing) {
+			try {
+				rs2::frameset frames;
+				// time out periodically so that we notice when capture is stopped
+				if (!p.try_wait_for_frames(&frames, 100)) continue;
+
+				if (params_changed.exchange(false)) {
+					std::lock_guard<std::mutex> lock(params_mutex);
+					current = params;
+				}
+
+				if (process(frames, current, slots[triple.back])) {
+					triple.publish();
+				}
+			} catch (const rs2::error& e) {
+				printf("capture error: %s\n", e.what());
+			}
+		}
+	}
+
+	// the current processing parameters
+	// (the arrays are compared with the last values seen, as JS may have modified them in place)
+	const CloudParams& get_params() {
+		const glm::mat4 transform = glm::make_mat4(modelmatrix_data);
+		const glm::vec3 min = glm::make_vec3(min_data);
+		const glm::vec3 max = glm::make_vec3(max_data);
+		if (transform != current_params.transform || min != current_params.min || max != current_params.max || maxarea != current_params.maxarea
+			|| downsample != current_params.downsample || downsample_median != current_params.median
+			|| smooth_alpha != current_params.smooth_alpha || smooth_threshold != current_params.smooth_threshold 
+			|| smooth_persistence != current_params.smooth_persistence || edge != current_params.edge) {
+			current_params.transform = transform;
+			current_params.min = min;
+			current_params.max = max;
+			current_params.maxarea = maxarea;
+			current_params.downsample = downsample;
+			current_params.median = downsample_median;
+			current_params.smooth_alpha = smooth_alpha;
+			current_params.smooth_threshold = smooth_threshold;
+			current_params.smooth_persistence = smooth_persistence;
+			current_params.edge = edge;
+			params_dirty = true;
+		}
+		return current_params;
+	}
+
+	// hand the current parameters to the processing thread, if they changed
+	void share_params() {
+		get_params();
+		if (!params_dirty) return;
+		{
+			std::lock_guard<std::mutex> lock(params_mutex);
+			params = current_params;
+		}
+		params_changed = true;
+		params_dirty = false;
+	}
+
+	// Run the point pipeline on a frameset: filter the depth, deproject it, flip into GL coordinates, apply the transform, and cull into the index list. 
+	// This does not touch any JS values, so it is safe to call from a worker thread. 
+	// Returns false if there is no depth frame, or if it does not fit the output buffer
+	// (with emit_indices false, only the vertices are written)
+	bool process(const rs2::frameset& frames, const CloudParams& params, CloudBuffer& out, bool emit_indices = true) {
+		return process(frames, filters.apply(frames.get_depth_frame(), out.filter_times), params, out, emit_indices);
+	}
+
+	// as above, with the depth frame already filtered
+	bool process(const rs2::frameset& frames, const rs2::depth_frame& depth, const CloudParams& params, CloudBuffer& out, bool emit_indices = true) {
+		out.has_accel = false;
+		if (rs2::motion_frame accel_frame = frames.first_or_default(RS2_STREAM_ACCEL)) {
+			rs2_vector a = accel_frame.get_motion_data();
+			out.accel = glm::vec3(a.x, a.y, a.z);
+			out.has_accel = true;
+		}
+
+		if (!depth) return false;
+		return process_depth(depth, params, out, emit_indices);
+	}
+
+	bool process_depth(const rs2::depth_frame& depth, const CloudParams& params, CloudBuffer& out, bool emit_indices = true) {
+		out.received = std::chrono::duration<double, std::milli>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+		const int factor = params.downsample;
+		const int width = depth.get_width() / factor;
+		const int height = depth.get_height() / factor;
+		const size_t num_vertices = width * height;
+		if (num_vertices > out.capacity) return false;
+
+		ThreadPool& pool = thread_pool();
+		rs2_intrinsics intrin = depth.get_profile().as<rs2::video_stream_profile>().get_intrinsics();
+		const uint8_t * data = (const uint8_t *)depth.get_data();
+		int stride = depth.get_stride_in_bytes();
+		if (factor > 1) {
+			// downsample the Z16 first, so that everything after works on the reduced grid:
+			downsampled.resize(num_vertices);
+			const int src_width = depth.get_width();
+			const int bands = pool.bands_for(height, 4);
+			pool.parallel_for(bands, [&](int band) {
+				int y0, y1;
+				ThreadPool::band_range(band, bands, height, y0, y1);
+				std::vector<uint16_t> scratch(std::max(src_width, factor*factor));
+				downsample_z16_rows(data, stride, src_width, factor, params.median, y0, y1, downsampled.data(), scratch.data());
+			});
+			intrin = downsample_intrinsics(intrin, factor);
+			data = (const uint8_t *)downsampled.data();
+			stride = width * sizeof(uint16_t);
+		}
+
+		if (params.smooth_alpha > 0.f) {
+			// smooth into the per-pixel state (restarting if the grid size changed), and deproject that:
+			if (smooth_state.size() != num_vertices) {
+				smooth_state.assign(num_vertices, 0);
+				smooth_missing.assign(num_vertices, 0);
+			}
+			const SmoothZ16Params sk(params.smooth_alpha, int(params.smooth_threshold / depth.get_units() + 0.5f), params.smooth_persistence);
+			const int bands = pool.bands_for(height, 8);
+			pool.parallel_for(bands, [&](int band) {
+				int y0, y1;
+				ThreadPool::band_range(band, bands, height, y0, y1);
+				for (int y=y0; y<y1; y++) {
+					smooth_z16(sk, (const uint16_t *)(data + y*stride), width, &smooth_state[y*width], &smooth_missing[y*width]);
+				}
+			});
+			data = (const uint8_t *)smooth_state.data();
+			stride = width * sizeof(uint16_t);
+		} else if (!smooth_state.empty()) {
+			// so that turning it back on starts afresh
+			smooth_state.clear();
+			smooth_missing.clear();
+		}
+
+		// Rather than rs2::pointcloud (which writes a whole points frame that we then transform in a second pass), 
+		// go straight from Z16 to transformed, culled vertices in one pass, using the precomputed rays. 
+		ray_table.update(intrin);
+
+		// Flying pixels are zeroed in a copy of each row just before it is deprojected, 
+		// and the kernel then culls zero depths, so that they get no index. 
+		const bool reject_flying = emit_indices && params.edge > 0.f;
+		const uint16_t edge_ratio = uint16_t(params.edge * 65536.f);
+
+		// intel coordinate system is weird: y is down, z is forward. we need to flip that.
+		// we also apply the modelmatrix here (see PointKernelParams)
+		const PointKernelParams k(params.transform, params.min, params.max, depth.get_units(), emit_indices, reject_flying);
+		// SSE4.1 or AVX2 if available, specialized for identity transform, culling, etc.
+		const PointKernel kernel = point_kernel(k);
+
+		// Split the image into bands of rows, processed in parallel. 
+		// Each band writes its indices starting at its own first pixel, which can't overlap the other bands 
+		// (a band never has more indices than pixels). 
+		const int bands = pool.bands_for(height, 8);
+		std::vector<uint32_t> band_counts(bands);
+		pool.parallel_for(bands, [&](int band) {
+			int y0, y1;
+			ThreadPool::band_range(band, bands, height, y0, y1);
+			uint32_t * band_indices = out.indices + y0*width;
+			uint32_t count = 0;
+			std::vector<uint16_t> filtered(reject_flying ? width : 0);
+			for (int y=y0; y<y1; y++) {
+				const uint16_t * row = (const uint16_t *)(data + y*stride);
+				if (reject_flying) {
+					const uint16_t * up = (y > 0) ? (const uint16_t *)(data + (y - 1)*stride) : nullptr;
+					const uint16_t * down = (y + 1 < height) ? (const uint16_t *)(data + (y + 1)*stride) : nullptr;
+					reject_flying_z16(up, row, down, width, edge_ratio, filtered.data());
+					row = filtered.data();
+				}
+				const uint32_t i = y*width;
+				count += kernel(k, row, &ray_table.rx[i], &ray_table.ry[i], width, i, out.vertices + i, band_indices + count);
+			}
+			band_counts[band] = count;
+		});
+
+		const uint32_t index_count = pack_bands(out.indices, band_counts, height, width);
+
+		out.width = width;
+		out.height = height;
+		out.count = index_count;
+		out.timestamp = depth.get_timestamp();
+		out.intrin = intrin;
+		out.transform = params.transform;
+		return true;
+	}
+
 
 	Napi::Value grab(const Napi::CallbackInfo& info) {
 		Napi::Env env = info.Env();
@@ -111,22 +994,11 @@ int wrap(int a, int n) {
 	
 		bool wait = info.Length() > 0 ? info[0].As<Napi::Boolean>() : false;
 
-		float maxarea = This.Has("maxarea") ?  This.Get("maxarea").ToNumber().DoubleValue() : 0.001;
-		glm::mat4 transform = This.Has("modelmatrix") ? glm::make_mat4(This.Get("modelmatrix").As<Napi::Float32Array>().Data()) : glm::mat4();
-		//float miny = This.Has("miny") ? This.Get("miny").ToNumber().DoubleValue() : 0.;
+		if (streaming()) return grab_threaded(info, wait);
+		// a grabAsync() is using the pipeline & arrays:
+		if (async_pending) return env.Null();
 
-		if (This.Has("min")) {
-			const Napi::Object value = This.Get("min").ToObject();
-			min.x = value.Get(uint32_t(0)).ToNumber().DoubleValue();
-			min.y = value.Get(uint32_t(1)).ToNumber().DoubleValue();
-			min.z = value.Get(uint32_t(2)).ToNumber().DoubleValue();
-		}
-		if (This.Has("max")) {
-			const Napi::Object value = This.Get("max").ToObject();
-			max.x = value.Get(uint32_t(0)).ToNumber().DoubleValue();
-			max.y = value.Get(uint32_t(1)).ToNumber().DoubleValue();
-			max.z = value.Get(uint32_t(2)).ToNumber().DoubleValue();
-		}
+		const CloudParams& params = get_params();
 
 		rs2::frameset frames;
 		if (wait) {
@@ -138,389 +1010,469 @@ int wrap(int a, int n) {
 			if (!p.poll_for_frames(&frames)) return env.Null();
 		}
 
-		if (rs2::motion_frame accel_frame = frames.first_or_default(RS2_STREAM_ACCEL)) {
-			rs2_vector a = accel_frame.get_motion_data();
-			accel[0] = a.x;
-			accel[1] = a.y;
-			accel[2] = a.z;
-			//printf("accel %f %f %f\n", accel.x, accel.y, accel.z);
-		}
-
-		// Try to get a frame of a depth image
-		// https://intelrealsense.github.io/librealsense/doxygen/classrs2_1_1depth__frame.html
-		rs2::depth_frame depth = frames.get_depth_frame();
-
-		
 		// rs2::pose_frame pose_frame = frames.get_pose_frame();
 		// rs2_pose pose = pose_frame.get_pose_data();
 		// printf("accel %f %f %f\n", pose.acceleration.x, pose.acceleration.y, pose.acceleration.z);
 
-		// frame depth.apply_filter (filter_interface &filter).as<rs2::depth_frame>();
+		process_into(env, This, frames, params);
+		return This;
+	}
+
+	// process a frameset on the main thread, into the JS arrays
+	void process_into(Napi::Env env, Napi::Object This, const rs2::frameset& frames, const CloudParams& params) {
+		// Try to get a frame of a depth image, and filter it
+		// https://intelrealsense.github.io/librealsense/doxygen/classrs2_1_1depth__frame.html
+		std::vector<float> filter_times;
+		rs2::depth_frame depth = filters.apply(frames.get_depth_frame(), filter_times);
+		if (!depth) return;
+		// make sure the JS arrays fit the (filtered & downsampled) frame, then process directly into them:
+		allocate(env, This, depth.get_width() / params.downsample, depth.get_height() / params.downsample);
+		CloudBuffer out = current_buffer();
+		out.filter_times.swap(filter_times);
+		process(frames, depth, params, out);
+		set_results(env, This, out);
+	}
 
+	// grab() when frames are processed off the main thread (threaded capture or onFrame): 
+	// hand the parameters to the processing thread, and swap in the most recently completed cloud
+	Napi::Value grab_threaded(const Napi::CallbackInfo& info, bool wait) {
+		Napi::Env env = info.Env();
+		Napi::Object This = info.This().As<Napi::Object>();
+
+		share_params();
+
+		while (!triple.acquire()) {
+			if (!wait || !streaming()) return env.Null();
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+
+		CloudBuffer& front = slots[triple.front];
+		this->vertices = front.vertices_ref.Value();
+		this->indices = front.indices_ref.Value();
+		This.Set("vertices", this->vertices);
+		This.Set("indices", this->indices);
+		set_results(env, This, front);
+
+		return This;
+	}
 
-		// Get the depth frame's dimensions
-		int width = depth.get_width();
-		int height = depth.get_height();
-		This.Set("width", width);
-		This.Set("height", height);
+	// make sure `vertices` and `indices` can hold a width x height frame, reallocating them if not
+	// (the arrays are looked up from the JS object, as napi handles don't outlive the call that created them)
+	void allocate(Napi::Env env, Napi::Object This, int width, int height) {
 		const size_t num_vertices = width * height;
 		const size_t num_floats = num_vertices * 3;
 		size_t MAX_NUM_INDICES = num_vertices;
-		// retrieve frame stride, meaning the actual line width in memory in bytes (not the logical image width)
-		int stride = depth.get_stride_in_bytes ();
-		int bitspp = depth.get_bits_per_pixel ();
-		int bytespp = depth.get_bytes_per_pixel ();
-		double t = depth.get_timestamp ();
-		const int sz = depth.get_data_size ();
-		const void * data = depth.get_data ();
-		// Query the distance from the Pipeline to the object in the center of the image
-		//float dist_to_center = depth.get_distance(width / 2, height / 2);
-		// Print the distance
-		// printf("The Pipeline is facing an object %f x %f meters away \n", depth.get_units(), dist_to_center);
-		// printf("size %d points %d x %d = %d \n", sz, width, height, width*height);
-
-		// {
-		// 	// const size_t num_bytes = num_floats * sizeof(float);
-		// 	if (!this->depth || this->depth.ElementLength() != num_floats) {
-		// 		// reallocate it:
-		// 		printf("reallocating %d floats\n", num_floats);
-		// 		this->depth = Napi::TypedArrayOf<float>::New(env, num_floats, napi_float32_array);
-		// 		This.Set("depth", this->depth);
-		// 	}
-
-
-		// Generate the pointcloud and texture mappings
-		points = pc.calculate(depth);
-		//const rs2::vertex * vertices = points.get_vertices ();
-		const glm::vec3 * raw_vertices = (glm::vec3 *)points.get_vertices ();  // xyz
-		//const rs2::texture_coordinate * texcoords = points.get_texture_coordinates (); // uv
-		//const glm::vec2 * texcoords = (glm::vec2 *)points.get_texture_coordinates (); // uv
-		
-		const size_t num_bytes = num_floats * sizeof(float);
-		if (!this->vertices || this->vertices.ElementLength() != num_floats) {
-			// reallocate it:
-			printf("reallocating %d floats\n", num_floats);
-			printf("width %d height %d num vertices %d %d\n", width, height, num_vertices, width * height);
-			this->vertices = Napi::TypedArrayOf<float>::New(env, num_floats, napi_float32_array);
-			This.Set("vertices", this->vertices);
-			
-			// this->normals = Napi::TypedArrayOf<float>::New(env, num_floats, napi_float32_array);
-			// This.Set("normals", this->normals);
-			
-			this->indices = Napi::TypedArrayOf<uint32_t>::New(env, MAX_NUM_INDICES, napi_uint32_array);
-			This.Set("indices", this->indices);
 
-			This.Set("count", Napi::Number::New(env, 0));
+		Napi::Value current = This.Get("vertices");
+		if (current.IsTypedArray() && current.As<Napi::Float32Array>().ElementLength() == num_floats
+			&& This.Get("indices").As<Napi::Uint32Array>().ElementLength() >= MAX_NUM_INDICES) {
+			this->vertices = current.As<Napi::Float32Array>();
+			this->indices = This.Get("indices").As<Napi::Uint32Array>();
+			return;
 		}
-		//memcpy(this->vertices.Data(), raw_vertices, num_bytes);
 
-	
-		// see https://intelrealsense.github.io/librealsense/doxygen/rs__export_8hpp_source.html
-		glm::vec3 * vertices = (glm::vec3 *)this->vertices.Data();
-		glm::vec3 * normals = (glm::vec3 *)this->normals.Data();
-		uint32_t * indices = (uint32_t *)this->indices.Data();
+		// reallocate it:
+		this->vertices = pooled_array<float>(env, num_floats, napi_float32_array);
+		This.Set("vertices", this->vertices);
 		
-		int index_count = 0;
-		for (int i=0; i<num_vertices; i++) {
-			glm::vec3& v = vertices[i];
-			const glm::vec3& rv = raw_vertices[i];
-
-			// intel coordinate system is weird: y is down, z is forward. we need to flip that.
-			// we also apply the modelmatrix here
-			v = glm::vec3(transform * glm::vec4(rv.x, -rv.y, -rv.z, 1.));
-
-			// meshless index array:
-			if (v.x > min.x && v.y > min.y && v.z > min.z && v.x < max.x && v.y < max.y && v.z < max.z) {
-				indices[index_count] = i;
-				index_count++;
+		// this->normals = Napi::TypedArrayOf<float>::New(env, num_floats, napi_float32_array);
+		// This.Set("normals", this->normals);
+		
+		this->indices = pooled_array<uint32_t>(env, MAX_NUM_INDICES, napi_uint32_array);
+		This.Set("indices", this->indices);
+
+		results.count = 0;
+	}
+
+	// a CloudBuffer that writes into the current `vertices` and `indices` arrays
+	CloudBuffer current_buffer() {
+		CloudBuffer out;
+		out.vertices = (glm::vec3 *)this->vertices.Data();
+		out.indices = (uint32_t *)this->indices.Data();
+		out.capacity = this->vertices.ElementLength() / 3;
+		return out;
+	}
+
+	// copy the results of processing a frame to the JS object
+	void set_results(Napi::Env env, Napi::Object This, const CloudBuffer& out) {
+		results.width = out.width;
+		results.height = out.height;
+		results.count = out.count;
+		results.timestamp = out.timestamp;
+		results.received = out.received;
+		results.intrin = out.intrin;
+		results.transform = out.transform;
+		results.filter_times = out.filter_times;
+		if (out.has_accel) {
+			accel[0] = out.accel.x;
+			accel[1] = out.accel.y;
+			accel[2] = out.accel.z;
+			//printf("accel %f %f %f\n", accel.x, accel.y, accel.z);
+		}
+	}
+
+	// grabAsync() waits for and processes a frame on the libuv threadpool
+	// writing into the existing `vertices` and `indices` arrays
+	struct GrabWorker : public Napi::AsyncWorker {
+		Camera * camera;
+		Napi::ObjectReference camera_ref;
+		Napi::Reference<Napi::Float32Array> vertices_ref;
+		Napi::Reference<Napi::Uint32Array> indices_ref;
+		Napi::Promise::Deferred deferred;
+		unsigned int timeout_ms;
+
+		CloudParams params;
+		CloudBuffer out;
+		rs2::frameset frames;
+		rs2::depth_frame depth;
+		bool processed = false;
+
+		GrabWorker(Napi::Env env, Camera * camera, Napi::Object This, unsigned int timeout_ms) 
+		: Napi::AsyncWorker(env, "grabAsync"), 
+		  camera(camera), 
+		  deferred(Napi::Promise::Deferred::New(env)),
+		  timeout_ms(timeout_ms) {
+			// hold on to the camera and its arrays while we work in the background:
+			camera_ref = Napi::Persistent(This);
+			vertices_ref = Napi::Persistent(camera->vertices);
+			indices_ref = Napi::Persistent(camera->indices);
+			params = camera->get_params();
+			out = camera->current_buffer();
+		}
+
+		// runs on the threadpool:
+		void Execute() override {
+			try {
+				if (!camera->p.try_wait_for_frames(&frames, timeout_ms)) {
+					SetError("timed out waiting for frames");
+					return;
+				}
+				depth = camera->filters.apply(frames.get_depth_frame(), out.filter_times);
+				processed = camera->process(frames, depth, params, out);
+			} catch (const rs2::error& e) {
+				SetError(e.what());
 			}
 		}
-		//printf("index count: %d %d\n", index_count, MAX_NUM_INDICES);
-		This.Set("count", Napi::Number::New(env, index_count));
 
-		return This;
+		void OnOK() override {
+			Napi::Env env = Env();
+			Napi::Object This = camera_ref.Value();
+			camera->async_pending = false;
+
+			if (!processed) {
+				// the frame didn't fit the arrays (e.g. resolution changed), so reallocate & process it here
+				// (the depth was already filtered, so the filters' state isn't advanced twice)
+				if (depth) {
+					camera->allocate(env, This, depth.get_width() / params.downsample, depth.get_height() / params.downsample);
+					std::vector<float> filter_times;
+					filter_times.swap(out.filter_times);
+					out = camera->current_buffer();
+					out.filter_times.swap(filter_times);
+					camera->process(frames, depth, params, out);
+				}
+			}
+			camera->set_results(env, This, out);
+			deferred.Resolve(This);
+		}
+
+		void OnError(const Napi::Error& e) override {
+			camera->async_pending = false;
+			deferred.Reject(e.Value());
+		}
+	};
+
+	// grabAsync(timeout_ms=15000) returns a Promise that resolves with the camera once a new frame has been processed
+	Napi::Value grabAsync(const Napi::CallbackInfo& info) {
+		Napi::Env env = info.Env();
+		Napi::Object This = info.This().As<Napi::Object>();
+		unsigned int timeout_ms = info.Length() > 0 ? info[0].ToNumber().Uint32Value() : 15000;
+
+		Napi::Promise::Deferred deferred = Napi::Promise::Deferred::New(env);
+		if (streaming()) {
+			deferred.Reject(Napi::Error::New(env, "grabAsync is not available with threaded or onFrame capture, use grab()").Value());
+			return deferred.Promise();
+		}
+		if (async_pending) {
+			deferred.Reject(Napi::Error::New(env, "grabAsync is already in progress").Value());
+			return deferred.Promise();
+		}
+
+		// make sure there are arrays to write into, sized from the stream profile:
+		if (!This.Get("vertices").IsTypedArray()) {
+			rs2::video_stream_profile depth_profile = p.get_active_profile().get_stream(RS2_STREAM_DEPTH).as<rs2::video_stream_profile>();
+			allocate(env, This, depth_profile.width(), depth_profile.height());
+		} else {
+			this->vertices = This.Get("vertices").As<Napi::Float32Array>();
+			this->indices = This.Get("indices").As<Napi::Uint32Array>();
+		}
+
+		async_pending = true;
+		GrabWorker * worker = new GrabWorker(env, this, This, timeout_ms);
+		worker->Queue();
+		return worker->deferred.Promise();
 	}
 
-	Napi::Value grab2(const Napi::CallbackInfo& info) {
+	// grabMesh(wait=false, normals=true) triangulates the depth grid
+	// `indices` then holds triangles (count is the number of indices), and `normals` holds smooth per-vertex normals
+	// triangles are culled by the min/max box and by `maxarea`
+	// normals can be:
+	// 	false: not computed
+	// 	true or "faces": the sum of the kept triangles' face normals around each vertex
+	// 	"grid": from the neighbouring vertices in the grid (see grid_normals_rows), which is faster, and smoother across small holes
+	Napi::Value grabMesh(const Napi::CallbackInfo& info) {
 		Napi::Env env = info.Env();
 		Napi::Object This = info.This().As<Napi::Object>();
 	
 		bool wait = info.Length() > 0 ? info[0].As<Napi::Boolean>() : false;
-		bool createMesh = info.Length() > 1 ? info[1].As<Napi::Boolean>() : true;
-		bool withNormals = info.Length() > 2 ? info[2].As<Napi::Boolean>() : true;
+		NormalsMode normals_mode = NORMALS_FACES;
+		if (info.Length() > 1) {
+			if (info[1].IsString()) {
+				normals_mode = info[1].ToString().Utf8Value() == "grid" ? NORMALS_GRID : NORMALS_FACES;
+			} else if (!info[1].ToBoolean()) {
+				normals_mode = NORMALS_NONE;
+			}
+		}
 
-		float maxarea = This.Has("maxarea") ?  This.Get("maxarea").ToNumber().DoubleValue() : 0.001;
-		glm::mat4 transform = This.Has("modelmatrix") ? glm::make_mat4(This.Get("modelmatrix").As<Napi::Float32Array>().Data()) : glm::mat4();
-		//float miny = This.Has("miny") ? This.Get("miny").ToNumber().DoubleValue() : 0.;
+		// meshing is only done on the main thread:
+		if (streaming() || async_pending) return env.Null();
 
-		if (This.Has("min")) {
-			const Napi::Object value = This.Get("min").ToObject();
-			min.x = value.Get(uint32_t(0)).ToNumber().DoubleValue();
-			min.y = value.Get(uint32_t(1)).ToNumber().DoubleValue();
-			min.z = value.Get(uint32_t(2)).ToNumber().DoubleValue();
-		}
-		if (This.Has("max")) {
-			const Napi::Object value = This.Get("max").ToObject();
-			max.x = value.Get(uint32_t(0)).ToNumber().DoubleValue();
-			max.y = value.Get(uint32_t(1)).ToNumber().DoubleValue();
-			max.z = value.Get(uint32_t(2)).ToNumber().DoubleValue();
-		}
+		const CloudParams& params = get_params();
 
 		rs2::frameset frames;
 		if (wait) {
-			// https://intelrealsense.github.io/librealsense/doxygen/classrs2_1_1frameset.html
-			// Block program until frames arrive
 			frames = p.wait_for_frames();
 		} else {
-			// non-blocking:
 			if (!p.poll_for_frames(&frames)) return env.Null();
 		}
 
-		if (rs2::motion_frame accel_frame = frames.first_or_default(RS2_STREAM_ACCEL)) {
-			rs2_vector a = accel_frame.get_motion_data();
-			accel[0] = a.x;
-			accel[1] = a.y;
-			accel[2] = a.z;
-			//printf("accel %f %f %f\n", accel.x, accel.y, accel.z);
-		}
+		std::vector<float> filter_times;
+		rs2::depth_frame depth = filters.apply(frames.get_depth_frame(), filter_times);
+		if (!depth) return env.Null();
+		const int width = depth.get_width() / params.downsample;
+		const int height = depth.get_height() / params.downsample;
+		allocate_mesh(env, This, width, height);
 
-		// Try to get a frame of a depth image
-		// https://intelrealsense.github.io/librealsense/doxygen/classrs2_1_1depth__frame.html
-		rs2::depth_frame depth = frames.get_depth_frame();
+		// deproject & transform all the vertices:
+		CloudBuffer out = current_buffer();
+		out.filter_times.swap(filter_times);
+		process(frames, depth, params, out, false);
+		out.count = mesh(out, params, normals_mode, (glm::vec3 *)This.Get("normals").As<Napi::Float32Array>().Data());
+		set_results(env, This, out);
 
-		
-		// rs2::pose_frame pose_frame = frames.get_pose_frame();
-		// rs2_pose pose = pose_frame.get_pose_data();
-		// printf("accel %f %f %f\n", pose.acceleration.x, pose.acceleration.y, pose.acceleration.z);
+		// auto color = frames.get_color_frame();
+		// // Tell pointcloud object to map to this color frame
+		// pc.map_to(color);
 
-		// frame depth.apply_filter (filter_interface &filter).as<rs2::depth_frame>();
+		return This;
+	}
 
+	// make sure `vertices`, `normals` and `indices` are large enough for a width x height mesh
+	void allocate_mesh(Napi::Env env, Napi::Object This, int width, int height) {
+		allocate(env, This, width, height);
 
-		// Get the depth frame's dimensions
-		int width = depth.get_width();
-		int height = depth.get_height();
-		const size_t num_vertices = width * height;
-		const size_t num_floats = num_vertices * 3;
+		const size_t num_floats = width * height * 3;
 		size_t MAX_NUM_FACES = (width - 1)*(height - 1)*2;
-		size_t MAX_NUM_INDICES = MAX_NUM_FACES*6; // two triangles per face
-		// retrieve frame stride, meaning the actual line width in memory in bytes (not the logical image width)
-		int stride = depth.get_stride_in_bytes ();
-		int bitspp = depth.get_bits_per_pixel ();
-		int bytespp = depth.get_bytes_per_pixel ();
-		double t = depth.get_timestamp ();
-		const int sz = depth.get_data_size ();
-		const void * data = depth.get_data ();
-		// Query the distance from the Pipeline to the object in the center of the image
-		//float dist_to_center = depth.get_distance(width / 2, height / 2);
-		// Print the distance
-		// printf("The Pipeline is facing an object %f x %f meters away \n", depth.get_units(), dist_to_center);
-		// printf("size %d points %d x %d = %d \n", sz, width, height, width*height);
-
-		// {
-		// 	// const size_t num_bytes = num_floats * sizeof(float);
-		// 	if (!this->depth || this->depth.ElementLength() != num_floats) {
-		// 		// reallocate it:
-		// 		printf("reallocating %d floats\n", num_floats);
-		// 		this->depth = Napi::TypedArrayOf<float>::New(env, num_floats, napi_float32_array);
-		// 		This.Set("depth", this->depth);
-		// 	}
-
-		{
-			// Generate the pointcloud and texture mappings
-			points = pc.calculate(depth);
-			//const rs2::vertex * vertices = points.get_vertices ();
-			const float * vertices = (float *)points.get_vertices ();  // xyz
-			//const rs2::texture_coordinate * texcoords = points.get_texture_coordinates (); // uv
-			const float * texcoords = (float *)points.get_texture_coordinates (); // uv
-			
-			const size_t num_bytes = num_floats * sizeof(float);
-			if (!this->vertices || this->vertices.ElementLength() != num_floats) {
-				// reallocate it:
-				printf("reallocating %d floats\n", num_floats);
-				printf("width %d height %d num vertices %d %d\n", width, height, num_vertices, width * height);
-				this->vertices = Napi::TypedArrayOf<float>::New(env, num_floats, napi_float32_array);
-				This.Set("vertices", this->vertices);
-				
-				this->normals = Napi::TypedArrayOf<float>::New(env, num_floats, napi_float32_array);
-				This.Set("normals", this->normals);
-				
-				this->indices = Napi::TypedArrayOf<uint32_t>::New(env, MAX_NUM_INDICES, napi_uint32_array);
-				This.Set("indices", this->indices);
-
-				This.Set("count", Napi::Number::New(env, 0));
-			}
-			
-			memcpy(this->vertices.Data(), vertices, num_bytes);
+		size_t MAX_NUM_INDICES = MAX_NUM_FACES*3; 
+		if (this->indices.ElementLength() < MAX_NUM_INDICES) {
+			this->indices = pooled_array<uint32_t>(env, MAX_NUM_INDICES, napi_uint32_array);
+			This.Set("indices", this->indices);
 		}
+		Napi::Value current = This.Get("normals");
+		if (!current.IsTypedArray() || current.As<Napi::Float32Array>().ElementLength() != num_floats) {
+			this->normals = pooled_array<float>(env, num_floats, napi_float32_array);
+			This.Set("normals", this->normals);
+		}
+	}
 
-	
-		// see https://intelrealsense.github.io/librealsense/doxygen/rs__export_8hpp_source.html
-		glm::vec3 * vertices = (glm::vec3 *)this->vertices.Data();
-		glm::vec3 * normals = (glm::vec3 *)this->normals.Data();
-		uint32_t * indices = (uint32_t *)this->indices.Data();
-		// create a triangle mesh
-		int index_count = 0;
-
-		// apply transform:
-		for (int i=0; i<num_vertices; i++) {
-			glm::vec3& v = vertices[i];
-			// flip to ogl coordinate system
-			v = glm::vec3(transform * glm::vec4(v.x, -v.y, -v.z, 1.));
-
-			
-
-			// meshless index array:
-			if (!createMesh && v.x > min.x && v.y > min.y && v.z > min.z && v.x < max.x && v.y < max.y && v.z < max.z) {
-				indices[index_count] = i;
-				index_count++;
-			}
+	// Triangulate the vertex grid in `out` (see mesh_rows), in parallel tiles of rows. 
+	// Each tile writes its triangles at its own offset, and the tiles are then packed together in order, 
+	// so the result is the same however many threads there are. 
+	// Normals are computed in a second parallel pass, once all triangles are known. 
+	// Returns the number of indices
+	uint32_t mesh(CloudBuffer& out, const CloudParams& params, NormalsMode normals_mode, glm::vec3 * normals) {
+		const int width = out.width, height = out.height;
+		if (width < 2 || height < 2) return 0;
+		const int quad_rows = height - 1;
+		const int indices_per_row = (width - 1) * 6;
+		quad_mask.resize((width - 1) * quad_rows);
+
+		ThreadPool& pool = thread_pool();
+		const int tiles = pool.bands_for(quad_rows, 8);
+		std::vector<uint32_t> tile_counts(tiles);
+		pool.parallel_for(tiles, [&](int tile) {
+			int y0, y1;
+			ThreadPool::band_range(tile, tiles, quad_rows, y0, y1);
+			tile_counts[tile] = mesh_rows(out.vertices, width, y0, y1, params.min, params.max, params.maxarea, out.indices + y0*indices_per_row, quad_mask.data());
+		});
+		const uint32_t index_count = pack_bands(out.indices, tile_counts, quad_rows, indices_per_row);
+
+		if (normals_mode != NORMALS_NONE) {
+			const int bands = pool.bands_for(height, 8);
+			pool.parallel_for(bands, [&](int band) {
+				int y0, y1;
+				ThreadPool::band_range(band, bands, height, y0, y1);
+				if (normals_mode == NORMALS_GRID) {
+					grid_normals_rows(out.vertices, width, height, y0, y1, params.min, params.max, params.maxarea, normals);
+				} else {
+					mesh_normals(out.vertices, quad_mask.data(), width, height, y0, y1, normals);
+				}
+			});
 		}
+		return index_count;
+	}
 
-		if (createMesh) {
-			for (int y = 0; y < height - 1; ++y) {
-				for (int x = 0; x < width - 1; ++x) {
-					// indices of a quad
-					int a = y * width + x, 
-						b = y * width + (x+1), 
-						c = (y+1)*width + x, 
-						d = (y+1)*width + (x+1);
-
-					// raw point data:
-					// vec3d point_a = { verts[a].x ,  -1 * verts[a].y,  -1 * verts[a].z };
-					// vec3d point_b = { verts[b].x ,  -1 * verts[b].y,  -1 * verts[b].z };
-					// vec3d point_c = { verts[c].x ,  -1 * verts[c].y,  -1 * verts[c].z };
-					// vec3d point_d = { verts[d].x ,  -1 * verts[d].y,  -1 * verts[d].z };
-					glm::vec3& point_a = vertices[a];
-					glm::vec3& point_b = vertices[b];
-					glm::vec3& point_c = vertices[c];
-					glm::vec3& point_d = vertices[d];
-
-					glm::vec3 da = point_d - point_a;
-					glm::vec3 ba = point_b - point_a;
-					glm::vec3 ca = point_c - point_a;
-					
-					// normalized cross product of two triangle edges gives face normal
-					glm::vec3 daba = glm::cross(da, ba);
-					glm::vec3 cada = glm::cross(ca, da);
-					// |cross product| of two sides gives area parallelogram, twice area of triangle
-					// this will be zero if there are degenerate points
-					float abd = glm::length(daba);
-					float acd = glm::length(cada);
-
-					glm::vec3 n12;
-					// skip if any of these points are zero
-					// skip if triangle area is too large (or too small??)
-					if (point_a.x > min.x && point_b.x > min.x && point_d.x > min.x && 
-						point_a.y > min.y && point_b.y > min.y && point_d.y > min.y && 
-						point_a.z > min.z && point_b.z > min.z && point_d.z > min.z && 
-						point_a.x < max.x && point_b.x < max.x && point_d.x < max.x && 
-						point_a.y < max.y && point_b.y < max.y && point_d.y < max.y && 
-						point_a.z < max.z && point_b.z < max.z && point_d.z < max.z && 
-						abd > 0. && abd < maxarea) 
-					{
-						indices[index_count++] = a;
-						indices[index_count++] = d;
-						indices[index_count++] = b;
-						if (withNormals) {
-							glm::vec3 n = glm::normalize(daba);
-							n12 = n;
-							normals[a] = n;
-							normals[b] = n;
-							normals[d] = n12;
-						}
+	// the points of the last frame, for splatting into voxels
+	// (the arrays are looked up from the JS object, as napi handles don't outlive the call that created them)
+	PointSource point_source(Napi::Object This) {
+		PointSource source;
+		Napi::Value vertices_value = This.Get("vertices");
+		Napi::Value indices_value = This.Get("indices");
+		if (!vertices_value.IsTypedArray() || !indices_value.IsTypedArray()) return source;
+		source.vertices = (glm::vec3 *)vertices_value.As<Napi::Float32Array>().Data();
+		source.indices = indices_value.As<Napi::Uint32Array>().Data();
+		source.count = results.count;
+		return source;
+	}
 
-					}
-					if (point_a.x > min.x && point_c.x > min.x && point_d.x > min.x && 
-						point_a.y > min.y && point_c.y > min.y && point_d.y > min.y && 
-						point_a.z > min.z && point_c.z > min.z && point_d.z > min.z && 
-						point_a.x < max.x && point_c.x < max.x && point_d.x < max.x && 
-						point_a.y < max.y && point_c.y < max.y && point_d.y < max.y && 
-						point_a.z < max.z && point_c.z < max.z && point_d.z < max.z && 
-						acd > 0. && acd < maxarea) 
-					{
-						indices[index_count++] = d;
-						indices[index_count++] = a;
-						indices[index_count++] = c;
-						if (withNormals) {
-							glm::vec3 n = glm::normalize(cada);
-							n12 = glm::normalize(n12 + n);
-							normals[a] = n12;
-							normals[c] = n;
-							normals[d] = n12;
-						}
-					}
-				}
+	// the vertex grid of the last frame, with the pose and intrinsics that made it, for TSDF fusion
+	DepthView depth_view(Napi::Object This) {
+		DepthView view;
+		Napi::Value vertices_value = This.Get("vertices");
+		if (!vertices_value.IsTypedArray() || !results.width) return view;
+		Napi::Float32Array array = vertices_value.As<Napi::Float32Array>();
+		if (array.ElementLength() < size_t(results.width) * results.height * 3) return view;
+		view.vertices = (glm::vec3 *)array.Data();
+		view.width = results.width;
+		view.height = results.height;
+		view.transform = results.transform;
+		view.fx = results.intrin.fx;
+		view.fy = results.intrin.fy;
+		view.ppx = results.intrin.ppx;
+		view.ppy = results.intrin.ppy;
+		return view;
+	}
+
+	// scale every voxel by `factor`, in parallel chunks
+	static void scale_voxels(float * voxels_data, size_t num_voxels, float factor) {
+		ThreadPool& pool = thread_pool();
+		const int chunks = pool.bands_for(num_voxels, 65536);
+		pool.parallel_for(chunks, [&](int chunk) {
+			int start, end;
+			ThreadPool::band_range(chunk, chunks, num_voxels, start, end);
+			for (int i=start; i<end; i++) {
+				voxels_data[i] *= factor;
 			}
-		} 
-		//printf("index count: %d %d\n", index_count, MAX_NUM_INDICES);
-		This.Set("count", Napi::Number::New(env, index_count));
+		});
+	}
 
-		// auto color = frames.get_color_frame();
-		// // Tell pointcloud object to map to this color frame
-		// pc.map_to(color);
+	// float32array|uint8array|uint16array voxels, [dimx, dimy, dimz], lidar2voxels_mat, mul, add, [state]
+	// 
+	// By default every voxel is multiplied by `mul` before the points are added. 
+	// With a state object of {decay: "lazy", scale: 1}, the decay is instead tracked as a running scale factor:
+	// the grid holds unscaled values, the true value of a voxel is `voxels[i] * state.scale`, 
+	// and each call only touches the voxels that points land in. The grid is renormalized 
+	// (multiplied through by the scale, which is reset to 1) once the scale drifts beyond `state.renormalize` (default 1e-4) or its inverse. 
+	// The state object is updated by each call; pass `scale` to shaders as a uniform to read true values. 
+	// 
+	// The grid may also be a Uint8Array or Uint16Array, where `add` is in integer units, adding saturates, 
+	// and decay rounds down; or half floats in a Uint16Array, with {format: "half"} in the state object. 
+	// 
+	// With {layout: "tiled"} in the state object, the grid is stored as 8x8x8 tiles in Morton order (see VoxelLayout), 
+	// for better cache locality; it must then hold whole tiles. Use linearize() to convert it for upload. 
+	Napi::Value voxels(const Napi::CallbackInfo& info) {
+		Napi::Object This = info.This().As<Napi::Object>();
+		if (info.Length() < 5) return info.This();
 
+		const PointSource source = point_source(This);
+		uint32_t total = 0;
+		if (!splat_voxels(info, 0, &source, 1, splatter, &total)) return info.Env().Null();
 		return This;
 	}
 
-	// float32array voxels, [dimx, dimy, dimz], lidar2voxels_mat, mul, add
-	Napi::Value voxels(const Napi::CallbackInfo& info) {
+	// The body of voxels() and integrateVoxels(): splat `sources` into the grid described by the arguments 
+	// from info[arg] on (voxels, dim, lidar2voxels_mat, mul, add, [state]). 
+	// Returns false if a JS exception was thrown. 
+	static bool splat_voxels(const Napi::CallbackInfo& info, size_t arg, const PointSource * sources, int num_sources, VoxelSplatter& splatter, uint32_t * total) {
 		Napi::Env env = info.Env();
-		Napi::Object This = info.This().As<Napi::Object>();
-		if (info.Length() < 5) return info.This();
 
 		// voxel data:
-		Napi::Float32Array voxels_value = info[0].As<Napi::Float32Array>();
-		float * voxels_data = voxels_value.Data();
+		if (!info[arg].IsTypedArray()) {
+			Napi::TypeError::New(env, "voxels expects a Float32Array, Uint8Array or Uint16Array").ThrowAsJavaScriptException();
+			return false;
+		}
+		Napi::TypedArray voxels_value = info[arg].As<Napi::TypedArray>();
+		const napi_typedarray_type voxels_type = voxels_value.TypedArrayType();
+		void * voxels_data = (char *)voxels_value.ArrayBuffer().Data() + voxels_value.ByteOffset();
 		const size_t NUM_VOXELS = voxels_value.ElementLength();
 
-		const Napi::Object dim_value = info[1].ToObject();
+		const Napi::Object dim_value = info[arg+1].ToObject();
 		const int32_t DIMX = dim_value.Get(uint32_t(0)).ToNumber().Int32Value();
 		const int32_t DIMY = dim_value.Get(uint32_t(1)).ToNumber().Int32Value();
 		const int32_t DIMZ = dim_value.Get(uint32_t(2)).ToNumber().Int32Value();
 		glm::ivec3 dim(DIMX, DIMY, DIMZ);
 
-		glm::mat4 lidar2voxels_mat = glm::make_mat4(info[2].As<Napi::Float32Array>().Data());
+		glm::mat4 lidar2voxels_mat = glm::make_mat4(info[arg+2].As<Napi::Float32Array>().Data());
 
-		float voxels_mul =  info[3].ToNumber().DoubleValue();
-		float voxels_add =  info[4].ToNumber().DoubleValue();
+		float voxels_mul =  info[arg+3].ToNumber().DoubleValue();
+		float voxels_add =  info[arg+4].ToNumber().DoubleValue();
 
-		Napi::Float32Array vertices_value = this->vertices;
-		glm::vec3 * vertices = (glm::vec3 *)vertices_value.Data();
-		// const size_t NUM_FLOATS = vertices_value.ElementLength();
-		// const size_t NUM_POINTS = NUM_FLOATS/3;
+		Napi::Object state;
+		bool lazy = false;
+		bool tiled = false;
+		bool half = false;
+		if (info.Length() > arg+5 && info[arg+5].IsObject()) {
+			state = info[arg+5].ToObject();
+			lazy = state.Has("decay") && state.Get("decay").ToString().Utf8Value() == "lazy";
+			tiled = state.Has("layout") && state.Get("layout").ToString().Utf8Value() == "tiled";
+			half = state.Has("format") && state.Get("format").ToString().Utf8Value() == "half";
+		}
+		if (voxels_type != napi_float32_array && voxels_type != napi_uint8_array && voxels_type != napi_uint16_array) {
+			Napi::TypeError::New(env, "voxels expects a Float32Array, Uint8Array or Uint16Array").ThrowAsJavaScriptException();
+			return false;
+		}
+		if (lazy && voxels_type != napi_float32_array) {
+			// unscaled values grow without bound, which only float32 has the range for
+			Napi::TypeError::New(env, "voxels: lazy decay needs a Float32Array").ThrowAsJavaScriptException();
+			return false;
+		}
+		const VoxelLayout layout(dim, tiled);
+		if (tiled && NUM_VOXELS < layout.size()) {
+			Napi::RangeError::New(env, "voxels: a tiled grid needs room for whole 8x8x8 tiles").ThrowAsJavaScriptException();
+			return false;
+		}
 
-		uint32_t * indices = (uint32_t *)this->indices.Data();
-		uint32_t count = This.Get("count").ToNumber().Int32Value();
-		
-		// // decay:
-		for (size_t i=0; i<NUM_VOXELS; i++) {
-			voxels_data[i] *= voxels_mul;
-		}
-		int total = 0;
-
-		for (uint32_t idx=0; idx < count; idx++) {
-			uint32_t i = indices[idx];
-
-			// copy floats:
-			const glm::vec3& V = vertices[i];
-			// convert to voxel space:
-			const glm::vec4 v = lidar2voxels_mat * glm::vec4(V, 1.);
-			// compute index:
-			int x = v.x * DIMX;
-			int y = v.y * DIMY;
-			int z = v.z * DIMZ;
-			if (x >= 0 && x < DIMX && y >= 0 && y < DIMY && z >= 0 && z < DIMZ) {
-				int j = x + y*(DIMX) + z*(DIMX*DIMY);//
-
-				// should this clamp rather than add? 
-				voxels_data[j] += voxels_add;
-				total++;
+		// decay:
+		bool decay = true;
+		if (lazy) {
+			double scale = state.Has("scale") ? state.Get("scale").ToNumber().DoubleValue() : 1.;
+			const double renormalize = state.Has("renormalize") ? state.Get("renormalize").ToNumber().DoubleValue() : 1e-4;
+			scale *= voxels_mul;
+			if (scale <= 0.) {
+				// everything has decayed away
+				memset(voxels_data, 0, NUM_VOXELS * sizeof(float));
+				scale = 1.;
+			} else if (scale < renormalize || scale > 1./renormalize) {
+				scale_voxels((float *)voxels_data, NUM_VOXELS, scale);
+				scale = 1.;
 			}
+			state.Set("scale", scale);
+			// points are added in unscaled units:
+			voxels_add /= scale;
+			decay = false;
 		}
-		//printf("added %d points %s %s\n", count, glm::to_string(min).c_str(), glm::to_string(max).c_str());
-		//printf("added %d points\n", total);
 
-		return This;
+		// decay (unless lazy) & splat, in parallel z slabs:
+		if (voxels_type == napi_uint8_array) {
+			*total = splatter.splat<VoxelU8>((uint8_t *)voxels_data, NUM_VOXELS, layout, lidar2voxels_mat, sources, num_sources, voxels_mul, voxels_add, decay);
+		} else if (voxels_type == napi_uint16_array && half) {
+			*total = splatter.splat<VoxelF16>((uint16_t *)voxels_data, NUM_VOXELS, layout, lidar2voxels_mat, sources, num_sources, voxels_mul, voxels_add, decay);
+		} else if (voxels_type == napi_uint16_array) {
+			*total = splatter.splat<VoxelU16>((uint16_t *)voxels_data, NUM_VOXELS, layout, lidar2voxels_mat, sources, num_sources, voxels_mul, voxels_add, decay);
+		} else {
+			*total = splatter.splat<VoxelF32>((float *)voxels_data, NUM_VOXELS, layout, lidar2voxels_mat, sources, num_sources, voxels_mul, voxels_add, decay);
+		}
+		//printf("added %d points\n", *total);
+		return true;
 	}
 
 	Napi::Value get_vertices(const Napi::CallbackInfo& info) {
@@ -531,13 +1483,14 @@ int wrap(int a, int n) {
 		const size_t num_floats = num_vertices * 3;
 		const size_t num_bytes = num_floats * sizeof(float);
 
-		// if (!vertices_ab || vertices_ab.ByteLength() != num_bytes) {
-		// 	// reallocate it:
-		// 	vertices_ab = Napi::ArrayBuffer::New(env, num_bytes);
-		// 	This.Set("vertices_arraybuffer", vertices_ab);
-
-		vertices = Napi::TypedArrayOf<float>::New(env, num_vertices * 3, napi_float32_array);
-		// }
+		// only reallocate when the size changes:
+		Napi::Value current = This.Get("vertices");
+		if (current.IsTypedArray() && current.As<Napi::Float32Array>().ByteLength() == num_bytes) {
+			vertices = current.As<Napi::Float32Array>();
+		} else {
+			vertices = pooled_array<float>(env, num_floats, napi_float32_array);
+			This.Set("vertices", vertices);
+		}
 
 		//Napi::TypedArrayOf<float> vertices_float32array = Napi::TypedArrayOf<float>::New(env, num_vertices * 3, vertices_ab, 0, napi_float32_array);
 
@@ -575,9 +1528,531 @@ int wrap(int a, int n) {
 };
 
 
+// The Camera of a JS value, or nullptr (having thrown a TypeError) if it isn't one.
+// Use this rather than Camera::Unwrap() on values from JS, which would unwrap any wrapped object as a Camera.
+Camera * unwrap_camera(Napi::Env env, const Napi::Value& value) {
+	// (the napi calls are used directly, as node-addon-api 3.x has no wrappers for type tags)
+	bool tagged = false;
+	if (value.IsObject()) napi_check_object_type_tag(env, value, &CAMERA_TYPE_TAG, &tagged);
+	if (!tagged) {
+		Napi::TypeError::New(env, "expected a Camera").ThrowAsJavaScriptException();
+		return nullptr;
+	}
+	return Camera::Unwrap(value.As<Napi::Object>());
+}
+
+/*
+	Several cameras' point clouds fused into one buffer, for a single upload & draw call
+	
+	const group = new CameraGroup([cam1, cam2])
+	group.grab()	// grabs from each camera, then gathers the points
+	gl.drawArrays(gl.POINTS, 0, group.count)
+
+	`vertices` holds the culled points of all the cameras (already in world space through each camera's modelmatrix), 
+	and `ids` the index of the camera each point came from (a Uint8Array), both packed from 0 to `count`. 
+	The arrays are reused from frame to frame, but replaced when they need to grow. 
+
+	sync() instead pulls framesets from the cameras itself, and only processes sets whose depth timestamps lie 
+	within `tolerance` ms of each other (see sync.h), so that a moving subject isn't fused from different moments. 
+	The cameras must be started without {threaded: true} or onFrame(), and global time enabled (the default). 
+	Options: new CameraGroup(cameras, { tolerance: 10, queue: 4 }), where `queue` is the framesets buffered per camera. 
+*/
+class CameraGroup : public Napi::ObjectWrap<CameraGroup> {
+public:
+
+	std::vector<Napi::ObjectReference> camera_refs;
+	uint32_t count = 0;
+
+	FrameSynchronizer<rs2::frameset> synchronizer;
+	std::vector<rs2::frameset> matched;
+	// timestamp spread of the last set released by sync() (ms)
+	double skew = 0;
+
+	CameraGroup(const Napi::CallbackInfo& info) : Napi::ObjectWrap<CameraGroup>(info) {
+		Napi::Env env = info.Env();
+		if (info.Length() < 1 || !info[0].IsArray()) {
+			Napi::TypeError::New(env, "CameraGroup expects an array of cameras").ThrowAsJavaScriptException();
+			return;
+		}
+		if (info.Length() > 1 && info[1].IsObject()) {
+			const Napi::Object options = info[1].ToObject();
+			if (options.Has("tolerance")) synchronizer.tolerance = options.Get("tolerance").ToNumber().DoubleValue();
+			if (options.Has("queue")) synchronizer.max_queue = std::max(1u, options.Get("queue").ToNumber().Uint32Value());
+		}
+		Napi::Array cameras = info[0].As<Napi::Array>();
+		if (cameras.Length() > 256) {
+			Napi::RangeError::New(env, "CameraGroup supports up to 256 cameras").ThrowAsJavaScriptException();
+			return;
+		}
+		for (uint32_t i=0; i<cameras.Length(); i++) {
+			// the other methods unwrap camera_refs without checking, relying on this:
+			Napi::Value camera_value = cameras.Get(i);
+			if (!unwrap_camera(env, camera_value)) return;
+			camera_refs.push_back(Napi::Persistent(camera_value.As<Napi::Object>()));
+		}
+		synchronizer.resize(int(camera_refs.size()));
+	}
+
+	// sync([wait], [timeout_ms=50])
+	// buffers the framesets each camera has ready, and if a matched set is found, processes it into the cameras & then update()
+	// returns null if there is no matched set yet (with wait, polls until there is one, or for up to timeout_ms)
+	// Waiting blocks the main thread, so keep the timeout to about a frame; call sync() once per animation frame instead of waiting longer. 
+	Napi::Value sync(const Napi::CallbackInfo& info) {
+		Napi::Env env = info.Env();
+		bool wait = info.Length() > 0 ? info[0].ToBoolean() : false;
+		unsigned int timeout_ms = info.Length() > 1 ? info[1].ToNumber().Uint32Value() : 50;
+		const int num_cameras = int(camera_refs.size());
+		for (int c=0; c<num_cameras; c++) {
+			Camera * camera = Camera::Unwrap(camera_refs[c].Value());
+			if (camera->streaming() || camera->async_pending) {
+				Napi::Error::New(env, "sync() needs cameras without threaded, onFrame or grabAsync capture").ThrowAsJavaScriptException();
+				return env.Null();
+			}
+		}
+
+		const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+		while (true) {
+			for (int c=0; c<num_cameras; c++) {
+				Camera * camera = Camera::Unwrap(camera_refs[c].Value());
+				rs2::frameset frames;
+				while (camera->p.poll_for_frames(&frames)) {
+					if (rs2::depth_frame depth = frames.get_depth_frame()) {
+						synchronizer.push(c, depth.get_timestamp(), frames);
+					}
+				}
+			}
+			if (synchronizer.pop(matched, &skew)) break;
+			if (!wait || std::chrono::steady_clock::now() > deadline) return env.Null();
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+
+		for (int c=0; c<num_cameras; c++) {
+			Napi::Object camera_object = camera_refs[c].Value();
+			Camera * camera = Camera::Unwrap(camera_object);
+			camera->process_into(env, camera_object, matched[c], camera->get_params());
+		}
+		// release the frames back to the devices:
+		for (rs2::frameset& frames : matched) frames = rs2::frameset();
+		return update(info);
+	}
+
+	// grab([wait])
+	// calls grab(wait) on each camera, then update()
+	Napi::Value grab(const Napi::CallbackInfo& info) {
+		Napi::Env env = info.Env();
+		bool wait = info.Length() > 0 ? info[0].ToBoolean() : false;
+		for (Napi::ObjectReference& ref : camera_refs) {
+			Napi::Object camera_object = ref.Value();
+			camera_object.Get("grab").As<Napi::Function>().Call(camera_object, { Napi::Boolean::New(env, wait) });
+		}
+		return update(info);
+	}
+
+	// update()
+	// gathers the points of each camera's last frame
+	Napi::Value update(const Napi::CallbackInfo& info) {
+		Napi::Env env = info.Env();
+		Napi::Object This = info.This().As<Napi::Object>();
+
+		std::vector<PointSource> sources;
+		std::vector<uint32_t> offsets;
+		uint32_t total = 0;
+		for (Napi::ObjectReference& ref : camera_refs) {
+			Napi::Object camera_object = ref.Value();
+			sources.push_back(Camera::Unwrap(camera_object)->point_source(camera_object));
+			offsets.push_back(total);
+			total += sources.back().count;
+		}
+
+		Napi::Float32Array vertices_array = reusable_array<float>(env, This, "vertices", size_t(total) * 3, napi_float32_array);
+		Napi::Uint8Array ids_array = reusable_array<uint8_t>(env, This, "ids", total, napi_uint8_array);
+		glm::vec3 * vertices = (glm::vec3 *)vertices_array.Data();
+		uint8_t * ids = ids_array.Data();
+
+		// copy the cameras in parallel chunks:
+		ThreadPool& pool = thread_pool();
+		struct Chunk {
+			int camera;
+			int start, end;
+		};
+		std::vector<Chunk> chunks;
+		for (int c=0; c<int(sources.size()); c++) {
+			const int n = sources[c].count;
+			const int bands = pool.bands_for(n, 16384);
+			for (int band=0; band<bands; band++) {
+				Chunk chunk;
+				chunk.camera = c;
+				ThreadPool::band_range(band, bands, n, chunk.start, chunk.end);
+				chunks.push_back(chunk);
+			}
+		}
+		pool.parallel_for(int(chunks.size()), [&](int i) {
+			const Chunk& chunk = chunks[i];
+			const PointSource& src = sources[chunk.camera];
+			const uint32_t offset = offsets[chunk.camera];
+			for (int k=chunk.start; k<chunk.end; k++) {
+				vertices[offset + k] = src.vertices[src.indices[k]];
+			}
+			memset(ids + offset + chunk.start, chunk.camera, chunk.end - chunk.start);
+		});
+
+		count = total;
+		return This;
+	}
+
+	Napi::Value get_count(const Napi::CallbackInfo& info) {
+		return Napi::Number::New(info.Env(), count);
+	}
+
+	Napi::Value get_skew(const Napi::CallbackInfo& info) {
+		return Napi::Number::New(info.Env(), skew);
+	}
+
+	// number of framesets sync() discarded without a match
+	Napi::Value get_dropped(const Napi::CallbackInfo& info) {
+		return Napi::Number::New(info.Env(), double(synchronizer.dropped));
+	}
+
+	Napi::Value get_tolerance(const Napi::CallbackInfo& info) {
+		return Napi::Number::New(info.Env(), synchronizer.tolerance);
+	}
+
+	void set_tolerance(const Napi::CallbackInfo& info, const Napi::Value& value) {
+		synchronizer.tolerance = value.ToNumber().DoubleValue();
+	}
+
+	Napi::Value get_cameras(const Napi::CallbackInfo& info) {
+		Napi::Array cameras = Napi::Array::New(info.Env(), camera_refs.size());
+		for (uint32_t i=0; i<camera_refs.size(); i++) cameras[i] = camera_refs[i].Value();
+		return cameras;
+	}
+};
+
+/*
+	A sparse voxel volume in world space, stored as 8x8x8 bricks that are allocated as points arrive (see volume.h)
+	
+	new VoxelVolume({ voxelsize: 0.02 })
+*/
+class VoxelVolume : public Napi::ObjectWrap<VoxelVolume> {
+public:
+
+	SparseVolume volume;
+
+	// scratch memory for march(), one set per band of bricks:
+	struct MarchBand {
+		MarchingCubes mc;
+		std::vector<float> block;
+		std::vector<glm::vec3> vertices, normals;
+		std::vector<uint32_t> indices;
+	};
+	std::vector<MarchBand> march_bands;
+	std::vector<glm::ivec3> brick_coords, march_coords;
+
+	VoxelVolume(const Napi::CallbackInfo& info) : Napi::ObjectWrap<VoxelVolume>(info) {
+		if (info.Length() && info[0].IsObject()) {
+			const Napi::Object options = info[0].ToObject();
+			if (options.Has("voxelsize")) volume.voxel_size = options.Get("voxelsize").ToNumber().FloatValue();
+		}
+	}
+
+	// add(camera, add)
+	// adds `add` to the voxel each point of the camera's last frame lands in
+	// (the points are already in world space, having been transformed by the camera's modelmatrix)
+	Napi::Value add(const Napi::CallbackInfo& info) {
+		Napi::Env env = info.Env();
+		if (info.Length() < 1 || !info[0].IsObject()) {
+			Napi::TypeError::New(env, "add expects a camera").ThrowAsJavaScriptException();
+			return env.Null();
+		}
+		Napi::Object camera_object = info[0].ToObject();
+		Camera * camera = unwrap_camera(env, camera_object);
+		if (!camera) return env.Null();
+		float amount = (info.Length() > 1) ? info[1].ToNumber().FloatValue() : 1.f;
+
+		const PointSource source = camera->point_source(camera_object);
+		volume.splat(&source, 1, glm::mat4(1.f), amount);
+		return info.This();
+	}
+
+	// decay(mul, threshold=0.001)
+	// multiplies every voxel by `mul`, and frees bricks whose voxels have all fallen to `threshold` or below
+	Napi::Value decay(const Napi::CallbackInfo& info) {
+		float mul = (info.Length() > 0) ? info[0].ToNumber().FloatValue() : 1.f;
+		float threshold = (info.Length() > 1) ? info[1].ToNumber().FloatValue() : 0.001f;
+		volume.decay(mul, threshold);
+		return info.This();
+	}
+
+	// dense(float32array, [x, y, z] origin, [x, y, z] dim)
+	// copies a box of voxels (origin and dim in voxel units) into a dense grid, such as for a 3D texture
+	Napi::Value dense(const Napi::CallbackInfo& info) {
+		Napi::Env env = info.Env();
+		if (info.Length() < 3) return info.This();
+		if (!info[0].IsTypedArray() || info[0].As<Napi::TypedArray>().TypedArrayType() != napi_float32_array) {
+			Napi::TypeError::New(env, "dense expects a Float32Array").ThrowAsJavaScriptException();
+			return env.Null();
+		}
+		Napi::Float32Array out = info[0].As<Napi::Float32Array>();
+		const Napi::Object origin_value = info[1].ToObject();
+		const Napi::Object dim_value = info[2].ToObject();
+		glm::ivec3 origin, dim;
+		for (uint32_t i=0; i<3; i++) {
+			origin[i] = origin_value.Get(i).ToNumber().Int32Value();
+			dim[i] = dim_value.Get(i).ToNumber().Int32Value();
+		}
+		if (dim.x <= 0 || dim.y <= 0 || dim.z <= 0) return info.This();
+		if (out.ElementLength() < size_t(dim.x) * dim.y * dim.z) {
+			Napi::RangeError::New(env, "dense: array is smaller than dim").ThrowAsJavaScriptException();
+			return env.Null();
+		}
+		volume.export_dense(out.Data(), origin, dim);
+		return info.This();
+	}
+
+	// bricks([result])
+	// returns { count, coords: Int32Array, voxels: Float32Array } listing the active bricks for GPU upload:
+	// the [x, y, z] brick coordinates (in units of 8 voxels), and the 512 voxels of each brick (x fastest). 
+	// Pass the previous result to reuse its arrays when they are large enough. 
+	Napi::Value bricks(const Napi::CallbackInfo& info) {
+		Napi::Env env = info.Env();
+		const size_t num_bricks = volume.size();
+		Napi::Object result = (info.Length() && info[0].IsObject()) ? info[0].ToObject() : Napi::Object::New(env);
+
+		Napi::Value coords_value = result.Get("coords");
+		Napi::Value voxels_value = result.Get("voxels");
+		if (!coords_value.IsTypedArray() || coords_value.As<Napi::Int32Array>().ElementLength() < num_bricks * 3
+			|| !voxels_value.IsTypedArray() || voxels_value.As<Napi::Float32Array>().ElementLength() < num_bricks * SparseVolume::BRICK_VOXELS) {
+			// leave some room to grow:
+			const size_t capacity = num_bricks + num_bricks/4 + 16;
+			coords_value = pooled_array<int32_t>(env, capacity * 3, napi_int32_array);
+			voxels_value = pooled_array<float>(env, capacity * SparseVolume::BRICK_VOXELS, napi_float32_array);
+			result.Set("coords", coords_value);
+			result.Set("voxels", voxels_value);
+		}
+		const size_t count = volume.export_bricks(coords_value.As<Napi::Int32Array>().Data(), voxels_value.As<Napi::Float32Array>().Data(), num_bricks);
+		result.Set("count", Napi::Number::New(env, count));
+		return result;
+	}
+
+	// march(iso, [result])
+	// extracts the surface where voxels rise above `iso`, in world space (see march_result)
+	// Each brick is marched on its own, so memory follows the bricks rather than their bounding box;
+	// vertices on the faces between bricks are repeated, once for each side.
+	Napi::Value march(const Napi::CallbackInfo& info) {
+		Napi::Env env = info.Env();
+		const float iso = (info.Length() > 0) ? info[0].ToNumber().FloatValue() : 0.5f;
+		Napi::Object result = (info.Length() > 1 && info[1].IsObject()) ? info[1].ToObject() : Napi::Object::New(env);
+
+		// the cells of a brick are those whose lowest corner lies in it, so each brick's block includes a layer
+		// of its upper neighbours; the lower neighbours of allocated bricks are marched too (as zeros),
+		// so that the surface closes where the allocated bricks end:
+		volume.active_bricks(brick_coords);
+		march_coords.clear();
+		for (const glm::ivec3& b : brick_coords) {
+			for (int i=0; i<8; i++) march_coords.push_back(b - glm::ivec3(i & 1, (i >> 1) & 1, (i >> 2) & 1));
+		}
+		std::sort(march_coords.begin(), march_coords.end(), [](const glm::ivec3& a, const glm::ivec3& b) {
+			return (a.z != b.z) ? a.z < b.z : (a.y != b.y) ? a.y < b.y : a.x < b.x;
+		});
+		march_coords.erase(std::unique(march_coords.begin(), march_coords.end()), march_coords.end());
+
+		const int num_bricks = int(march_coords.size());
+		ThreadPool& pool = thread_pool();
+		const int bands = pool.bands_for(num_bricks, 16);
+		if (int(march_bands.size()) < bands) march_bands.resize(bands);
+		pool.parallel_for(bands, [&](int band) {
+			MarchBand& out = march_bands[band];
+			out.vertices.clear();
+			out.normals.clear();
+			out.indices.clear();
+			const int block_dim = SparseVolume::BRICK_DIM + 1;
+			out.block.resize(size_t(block_dim) * block_dim * block_dim);
+			int start, end;
+			ThreadPool::band_range(band, bands, num_bricks, start, end);
+			for (int i=start; i<end; i++) {
+				const glm::ivec3 origin = march_coords[i] * int(SparseVolume::BRICK_DIM);
+				volume.export_block(out.block.data(), origin, glm::ivec3(block_dim));
+				const size_t num_vertices = out.mc.prepare(out.block.data(), glm::ivec3(block_dim), iso, false);
+				if (!num_vertices) continue;
+
+				const size_t first_vertex = out.vertices.size();
+				out.vertices.resize(first_vertex + num_vertices);
+				out.normals.resize(first_vertex + num_vertices);
+				const glm::mat4 voxel2world = glm::scale(glm::vec3(volume.voxel_size)) * glm::translate(glm::vec3(origin) + 0.5f);
+				const size_t num_indices = out.mc.generate(&out.vertices[first_vertex], &out.normals[first_vertex], voxel2world);
+				const size_t first_index = out.indices.size();
+				out.indices.resize(first_index + num_indices);
+				out.mc.write_indices(out.indices.data() + first_index);
+				for (size_t j=first_index; j<out.indices.size(); j++) out.indices[j] += uint32_t(first_vertex);
+			}
+		});
+
+		// gather the bands' meshes:
+		size_t num_vertices = 0, num_indices = 0;
+		for (int band=0; band<bands; band++) {
+			num_vertices += march_bands[band].vertices.size();
+			num_indices += march_bands[band].indices.size();
+		}
+		Napi::Float32Array vertices = reusable_array<float>(env, result, "vertices", num_vertices * 3, napi_float32_array);
+		Napi::Float32Array normals = reusable_array<float>(env, result, "normals", num_vertices * 3, napi_float32_array);
+		Napi::Uint32Array indices = reusable_array<uint32_t>(env, result, "indices", num_indices, napi_uint32_array);
+		size_t vertex_offset = 0, index_offset = 0;
+		for (int band=0; band<bands; band++) {
+			const MarchBand& out = march_bands[band];
+			if (!out.vertices.empty()) {
+				memcpy(vertices.Data() + vertex_offset*3, out.vertices.data(), out.vertices.size() * sizeof(glm::vec3));
+				memcpy(normals.Data() + vertex_offset*3, out.normals.data(), out.normals.size() * sizeof(glm::vec3));
+			}
+			for (size_t j=0; j<out.indices.size(); j++) indices.Data()[index_offset + j] = out.indices[j] + uint32_t(vertex_offset);
+			vertex_offset += out.vertices.size();
+			index_offset += out.indices.size();
+		}
+		result.Set("vertexcount", Napi::Number::New(env, num_vertices));
+		result.Set("count", Napi::Number::New(env, num_indices));
+		return result;
+	}
+
+	Napi::Value clear(const Napi::CallbackInfo& info) {
+		volume.clear();
+		return info.This();
+	}
+
+	// number of allocated bricks
+	Napi::Value get_count(const Napi::CallbackInfo& info) {
+		return Napi::Number::New(info.Env(), volume.size());
+	}
+
+	Napi::Value get_voxelsize(const Napi::CallbackInfo& info) {
+		return Napi::Number::New(info.Env(), volume.voxel_size);
+	}
+};
+
+
+/*
+	A dense truncated signed distance volume, fused from the depth frames of one or more cameras (see tsdf.h)
+
+	new TsdfVolume({ dim: [128, 128, 128], origin: [-1.28, -1.28, -1.28], voxelsize: 0.02, truncation: 0.06, maxweight: 64 })
+
+	`tsdf` and `weights` are Float32Arrays of dim[0]*dim[1]*dim[2] voxels (x fastest), 
+	which can be uploaded as 3D textures; the surface is where tsdf crosses 0 (with weight > 0). 
+*/
+class TsdfVolume : public Napi::ObjectWrap<TsdfVolume> {
+public:
+
+	TsdfParams params;
+	TsdfIntegrator integrator;
+	MarchingCubes mc;
+	Napi::Reference<Napi::Float32Array> tsdf_ref, weights_ref;
+	float * tsdf = nullptr;
+	float * weights = nullptr;
+
+	TsdfVolume(const Napi::CallbackInfo& info) : Napi::ObjectWrap<TsdfVolume>(info) {
+		Napi::Env env = info.Env();
+		if (info.Length() && info[0].IsObject()) {
+			const Napi::Object options = info[0].ToObject();
+			for (uint32_t i=0; i<3; i++) {
+				if (options.Has("dim")) params.dim[i] = options.Get("dim").ToObject().Get(i).ToNumber().Int32Value();
+				if (options.Has("origin")) params.origin[i] = options.Get("origin").ToObject().Get(i).ToNumber().FloatValue();
+			}
+			if (options.Has("voxelsize")) params.voxel_size = options.Get("voxelsize").ToNumber().FloatValue();
+			if (options.Has("truncation")) params.truncation = options.Get("truncation").ToNumber().FloatValue();
+			if (options.Has("maxweight")) params.max_weight = options.Get("maxweight").ToNumber().FloatValue();
+		}
+		params.dim = glm::max(params.dim, glm::ivec3(1));
+
+		const size_t num_voxels = size_t(params.dim.x) * params.dim.y * params.dim.z;
+		Napi::Float32Array tsdf_array = pooled_array<float>(env, num_voxels, napi_float32_array);
+		Napi::Float32Array weights_array = pooled_array<float>(env, num_voxels, napi_float32_array);
+		tsdf_ref = Napi::Persistent(tsdf_array);
+		weights_ref = Napi::Persistent(weights_array);
+		tsdf = tsdf_array.Data();
+		weights = weights_array.Data();
+		clear_voxels();
+	}
+
+	// integrate(camera)
+	// fuses the camera's last frame, using the modelmatrix and intrinsics it was captured with
+	Napi::Value integrate(const Napi::CallbackInfo& info) {
+		Napi::Env env = info.Env();
+		if (info.Length() < 1 || !info[0].IsObject()) {
+			Napi::TypeError::New(env, "integrate expects a camera").ThrowAsJavaScriptException();
+			return env.Null();
+		}
+		Napi::Object camera_object = info[0].ToObject();
+		Camera * camera = unwrap_camera(env, camera_object);
+		if (!camera) return env.Null();
+
+		integrator.integrate(params, camera->depth_view(camera_object), tsdf, weights);
+		return info.This();
+	}
+
+	// march([result])
+	// extracts the fused surface, in world space (see march_result)
+	Napi::Value march(const Napi::CallbackInfo& info) {
+		Napi::Env env = info.Env();
+		Napi::Object result = (info.Length() > 0 && info[0].IsObject()) ? info[0].ToObject() : Napi::Object::New(env);
+		// unseen voxels hold +1 (in front of any surface), so only observed surfaces are found
+		const size_t num_vertices = mc.prepare(tsdf, params.dim, 0.f, true);
+		const glm::mat4 voxel2world = glm::translate(params.origin + 0.5f*params.voxel_size) * glm::scale(glm::vec3(params.voxel_size));
+		return march_result(env, mc, num_vertices, voxel2world, result);
+	}
+
+	Napi::Value clear(const Napi::CallbackInfo& info) {
+		clear_voxels();
+		return info.This();
+	}
+
+	void clear_voxels() {
+		const size_t num_voxels = size_t(params.dim.x) * params.dim.y * params.dim.z;
+		std::fill(tsdf, tsdf + num_voxels, 1.f);
+		std::fill(weights, weights + num_voxels, 0.f);
+	}
+
+	Napi::Value get_tsdf(const Napi::CallbackInfo& info) { return tsdf_ref.Value(); }
+	Napi::Value get_weights(const Napi::CallbackInfo& info) { return weights_ref.Value(); }
+
+	Napi::Value get_dim(const Napi::CallbackInfo& info) {
+		Napi::Array dim = Napi::Array::New(info.Env(), 3);
+		for (uint32_t i=0; i<3; i++) dim[i] = Napi::Number::New(info.Env(), params.dim[i]);
+		return dim;
+	}
+};
+
+
 class Module : public Napi::Addon<Module> {
 public:
 
+	// scratch memory for march() and integrateVoxels():
+	MarchingCubes mc;
+	VoxelSplatter splatter;
+
+	/*
+		integrateVoxels([cameras], voxels, [dimx, dimy, dimz], lidar2voxels_mat, mul, add, [state])
+		Like Camera.voxels, but for several cameras at once: the grid is decayed once, 
+		and the points of all the cameras' last frames are splatted together in parallel. 
+		Returns the number of points that landed in the grid. 
+	*/
+	Napi::Value integrateVoxels(const Napi::CallbackInfo& info) {
+		Napi::Env env = info.Env();
+		if (info.Length() < 6 || !info[0].IsArray()) {
+			Napi::TypeError::New(env, "integrateVoxels expects an array of cameras, voxels, dim, matrix, mul, add").ThrowAsJavaScriptException();
+			return env.Null();
+		}
+		Napi::Array cameras = info[0].As<Napi::Array>();
+		std::vector<PointSource> sources;
+		for (uint32_t i=0; i<cameras.Length(); i++) {
+			Napi::Value camera_value = cameras.Get(i);
+			Camera * camera = unwrap_camera(env, camera_value);
+			if (!camera) return env.Null();
+			Napi::Object camera_object = camera_value.As<Napi::Object>();
+			sources.push_back(camera->point_source(camera_object));
+		}
+
+		uint32_t total = 0;
+		if (!Camera::splat_voxels(info, 1, sources.data(), int(sources.size()), splatter, &total)) return env.Null();
+		return Napi::Number::New(env, total);
+	}
+
 	/*
 		Returns array
 	*/
@@ -637,6 +2112,92 @@ public:
 		return devices;
 	}
 
+	/*
+		Number of threads used to process each frame (including the calling thread)
+		Setting it to 0 restores the default, one per hardware core
+	*/
+	Napi::Value get_threads(const Napi::CallbackInfo& info) {
+		return Napi::Number::New(info.Env(), thread_pool().size());
+	}
+
+	void set_threads(const Napi::CallbackInfo& info, const Napi::Value& value) {
+		thread_pool().resize(value.ToNumber().Int32Value());
+	}
+
+	/*
+		march(voxels, [dimx, dimy, dimz], iso, [result])
+		Extracts the surface where a dense Float32Array voxel grid (as used by Camera.voxels) rises above `iso`, 
+		returning { vertices, normals, indices, vertexcount, count }. Vertices are in the unit cube of the grid, 
+		matching the voxel space of Camera.voxels. Pass the previous result to reuse its arrays. 
+	*/
+	Napi::Value march(const Napi::CallbackInfo& info) {
+		Napi::Env env = info.Env();
+		if (info.Length() < 3) return env.Null();
+		if (!info[0].IsTypedArray() || info[0].As<Napi::TypedArray>().TypedArrayType() != napi_float32_array) {
+			Napi::TypeError::New(env, "march expects a Float32Array of voxels").ThrowAsJavaScriptException();
+			return env.Null();
+		}
+		Napi::Float32Array voxels_value = info[0].As<Napi::Float32Array>();
+		const Napi::Object dim_value = info[1].ToObject();
+		glm::ivec3 dim;
+		for (uint32_t i=0; i<3; i++) dim[i] = dim_value.Get(i).ToNumber().Int32Value();
+		const float iso = info[2].ToNumber().FloatValue();
+		Napi::Object result = (info.Length() > 3 && info[3].IsObject()) ? info[3].ToObject() : Napi::Object::New(env);
+		if (glm::any(glm::lessThan(dim, glm::ivec3(0))) || voxels_value.ElementLength() < size_t(dim.x) * dim.y * dim.z) {
+			Napi::RangeError::New(env, "march: voxels array is smaller than dim").ThrowAsJavaScriptException();
+			return env.Null();
+		}
+
+		const size_t num_vertices = mc.prepare(voxels_value.Data(), dim, iso, false);
+		// voxel i spans [i, i+1)/dim:
+		const glm::mat4 voxel2unit = glm::scale(1.f / glm::vec3(glm::max(dim, glm::ivec3(1)))) * glm::translate(glm::vec3(0.5f));
+		return march_result(env, mc, num_vertices, voxel2unit, result);
+	}
+
+	/*
+		linearize(tiled, [dimx, dimy, dimz], linear)
+		Copies a grid stored with {layout: "tiled"} (see Camera.voxels) into a linear grid of the same type, x fastest. 
+		Returns the length the tiled grid needs if called with only a dim. 
+		Only Float32Array grids can be passed on to march(); integer and half grids must be converted first. 
+	*/
+	Napi::Value linearize(const Napi::CallbackInfo& info) {
+		Napi::Env env = info.Env();
+		const Napi::Object dim_value = info[info.Length() == 1 ? 0 : 1].ToObject();
+		glm::ivec3 dim;
+		for (uint32_t i=0; i<3; i++) dim[i] = std::max(0, dim_value.Get(i).ToNumber().Int32Value());
+		const VoxelLayout layout(dim, true);
+		if (info.Length() == 1) return Napi::Number::New(env, layout.size());
+		if (info.Length() < 3) return env.Null();
+
+		// any of the voxel formats, as long as both arrays are the same type:
+		if (!info[0].IsTypedArray() || !info[2].IsTypedArray()
+			|| info[0].As<Napi::TypedArray>().TypedArrayType() != info[2].As<Napi::TypedArray>().TypedArrayType()) {
+			Napi::TypeError::New(env, "linearize expects two typed arrays of the same type").ThrowAsJavaScriptException();
+			return env.Null();
+		}
+		switch (info[0].As<Napi::TypedArray>().TypedArrayType()) {
+			case napi_float32_array: return linearize_array<float>(env, info[0], layout, info[2]);
+			case napi_uint8_array: return linearize_array<uint8_t>(env, info[0], layout, info[2]);
+			case napi_uint16_array: return linearize_array<uint16_t>(env, info[0], layout, info[2]);
+			default:
+				Napi::TypeError::New(env, "linearize expects Float32Array, Uint8Array or Uint16Array voxels").ThrowAsJavaScriptException();
+				return env.Null();
+		}
+	}
+
+	template<typename T>
+	static Napi::Value linearize_array(Napi::Env env, const Napi::Value& src_value, const VoxelLayout& layout, const Napi::Value& dst_value) {
+		Napi::TypedArrayOf<T> src = src_value.As<Napi::TypedArrayOf<T> >();
+		Napi::TypedArrayOf<T> dst = dst_value.As<Napi::TypedArrayOf<T> >();
+		const glm::ivec3 dim = layout.dim;
+		if (src.ElementLength() < layout.size() || dst.ElementLength() < size_t(dim.x) * dim.y * dim.z) {
+			Napi::RangeError::New(env, "linearize: array is smaller than dim").ThrowAsJavaScriptException();
+			return env.Null();
+		}
+		voxels_to_linear(src.Data(), layout, dst.Data());
+		return dst;
+	}
+
 	// /*
 	// 	Returns array
 	// */
@@ -664,6 +2225,10 @@ public:
 		// See https://github.com/nodejs/node-addon-api/blob/main/doc/class_property_descriptor.md
 		DefineAddon(exports, {
 			InstanceAccessor<&Module::devices>("devices"),
+			InstanceAccessor<&Module::get_threads, &Module::set_threads>("threads"),
+			InstanceMethod<&Module::integrateVoxels>("integrateVoxels"),
+			InstanceMethod<&Module::march>("march"),
+			InstanceMethod<&Module::linearize>("linearize"),
 			// InstanceMethod("start", &Module::start),
 			// InstanceMethod("end", &Module::end),
 			// //InstanceMethod("test", &Module::test),
@@ -677,14 +2242,67 @@ public:
 		
 		// This method is used to hook the accessor and method callbacks
 		Napi::Function ctor = Camera::DefineClass(env, "Camera", {
+			Camera::InstanceAccessor<&Camera::get_modelmatrix, &Camera::set_modelmatrix>("modelmatrix"),
+			Camera::InstanceAccessor<&Camera::get_min, &Camera::set_min>("min"),
+			Camera::InstanceAccessor<&Camera::get_max, &Camera::set_max>("max"),
+			Camera::InstanceAccessor<&Camera::get_maxarea, &Camera::set_maxarea>("maxarea"),
+			Camera::InstanceAccessor<&Camera::get_downsample, &Camera::set_downsample>("downsample"),
+			Camera::InstanceAccessor<&Camera::get_downsample_mode, &Camera::set_downsample_mode>("downsampleMode"),
+			Camera::InstanceAccessor<&Camera::get_smoothing, &Camera::set_smoothing>("smoothing"),
+			Camera::InstanceAccessor<&Camera::get_edge, &Camera::set_edge>("edge"),
+			Camera::InstanceAccessor<&Camera::get_width>("width"),
+			Camera::InstanceAccessor<&Camera::get_height>("height"),
+			Camera::InstanceAccessor<&Camera::get_count>("count"),
+			Camera::InstanceAccessor<&Camera::get_timestamp>("timestamp"),
+			Camera::InstanceAccessor<&Camera::get_received>("received"),
+			Camera::InstanceAccessor<&Camera::get_filters, &Camera::set_filters>("filters"),
+			Camera::InstanceAccessor<&Camera::get_filter_times>("filterTimes"),
 			Camera::InstanceMethod<&Camera::start>("start"),
+			Camera::InstanceMethod<&Camera::stop>("stop"),
 		// 	Camera::InstanceMethod<&Camera::close>("close"),
 		// 	Camera::InstanceMethod<&Camera::isOpened>("isOpened"),
 			Camera::InstanceMethod<&Camera::grab>("grab"),
+			Camera::InstanceMethod<&Camera::grabAsync>("grabAsync"),
+			Camera::InstanceMethod<&Camera::grabMesh>("grabMesh"),
+			Camera::InstanceMethod<&Camera::onFrame>("onFrame"),
 			Camera::InstanceMethod<&Camera::voxels>("voxels"),
 			//Camera::InstanceMethod<&Camera::grab>("get_active_profile"),
 		});
 
+		Napi::Function volume_ctor = VoxelVolume::DefineClass(env, "VoxelVolume", {
+			VoxelVolume::InstanceAccessor<&VoxelVolume::get_count>("count"),
+			VoxelVolume::InstanceAccessor<&VoxelVolume::get_voxelsize>("voxelsize"),
+			VoxelVolume::InstanceMethod<&VoxelVolume::add>("add"),
+			VoxelVolume::InstanceMethod<&VoxelVolume::decay>("decay"),
+			VoxelVolume::InstanceMethod<&VoxelVolume::dense>("dense"),
+			VoxelVolume::InstanceMethod<&VoxelVolume::bricks>("bricks"),
+			VoxelVolume::InstanceMethod<&VoxelVolume::march>("march"),
+			VoxelVolume::InstanceMethod<&VoxelVolume::clear>("clear"),
+		});
+		exports.Set("VoxelVolume", volume_ctor);
+
+		Napi::Function group_ctor = CameraGroup::DefineClass(env, "CameraGroup", {
+			CameraGroup::InstanceAccessor<&CameraGroup::get_count>("count"),
+			CameraGroup::InstanceAccessor<&CameraGroup::get_cameras>("cameras"),
+			CameraGroup::InstanceAccessor<&CameraGroup::get_skew>("skew"),
+			CameraGroup::InstanceAccessor<&CameraGroup::get_dropped>("dropped"),
+			CameraGroup::InstanceAccessor<&CameraGroup::get_tolerance, &CameraGroup::set_tolerance>("tolerance"),
+			CameraGroup::InstanceMethod<&CameraGroup::grab>("grab"),
+			CameraGroup::InstanceMethod<&CameraGroup::sync>("sync"),
+			CameraGroup::InstanceMethod<&CameraGroup::update>("update"),
+		});
+		exports.Set("CameraGroup", group_ctor);
+
+		Napi::Function tsdf_ctor = TsdfVolume::DefineClass(env, "TsdfVolume", {
+			TsdfVolume::InstanceAccessor<&TsdfVolume::get_tsdf>("tsdf"),
+			TsdfVolume::InstanceAccessor<&TsdfVolume::get_weights>("weights"),
+			TsdfVolume::InstanceAccessor<&TsdfVolume::get_dim>("dim"),
+			TsdfVolume::InstanceMethod<&TsdfVolume::integrate>("integrate"),
+			TsdfVolume::InstanceMethod<&TsdfVolume::march>("march"),
+			TsdfVolume::InstanceMethod<&TsdfVolume::clear>("clear"),
+		});
+		exports.Set("TsdfVolume", tsdf_ctor);
+
 		// Create a persistent reference to the class constructor. This will allow
 		// a function called on a class prototype and a function
 		// called on instance of a class to be distinguished from each other.
@@ -0,0 +1,112 @@
+#ifndef REALSENSE_SYNC_H
+#define REALSENSE_SYNC_H
+
+/*
+	Matches frames from several independent streams (e.g. one per camera) by timestamp.
+
+	Each stream buffers its last few frames. A set is released when the oldest buffered frame of every stream
+	lies within `tolerance` of the newest of them; frames that are too old to ever be part of a set are dropped.
+	This trades up to a frame or so of delay for sets that were captured at (nearly) the same moment.
+
+	The timestamps must share a clock. For RealSense devices that means global time (the default on the D400
+	series), which maps each device's hardware clock onto the host clock.
+
+	Not thread-safe.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+template<typename Frame>
+class FrameSynchronizer {
+public:
+
+	// max spread of timestamps within a matched set (ms)
+	double tolerance = 10;
+	// frames buffered per stream, beyond which the oldest are dropped
+	size_t max_queue = 4;
+	// frames discarded without being released
+	uint64_t dropped = 0;
+
+	void resize(int num_streams) {
+		queues.assign(num_streams, std::deque<Entry>());
+	}
+
+	int size() const {
+		return int(queues.size());
+	}
+
+	void push(int stream, double timestamp, const Frame& frame) {
+		std::deque<Entry>& q = queues[stream];
+		// a timestamp going backwards means the stream restarted (or a recording looped), so what it buffered is stale:
+		if (!q.empty() && timestamp <= q.back().timestamp) {
+			dropped += q.size();
+			q.clear();
+		}
+		Entry entry;
+		entry.timestamp = timestamp;
+		entry.frame = frame;
+		q.push_back(entry);
+		while (q.size() > max_queue) {
+			q.pop_front();
+			dropped++;
+		}
+	}
+
+	// Release the newest matched set into `out` (one frame per stream), discarding anything older.
+	// `spread` receives the difference between its newest and oldest timestamps.
+	// Returns false, leaving `out` alone, if no set matches yet.
+	bool pop(std::vector<Frame>& out, double * spread = nullptr) {
+		const int n = size();
+		if (!n) return false;
+		bool found = false;
+		while (true) {
+			double newest = -1e300;
+			for (int i=0; i<n; i++) {
+				if (queues[i].empty()) return found;
+				newest = std::max(newest, queues[i].front().timestamp);
+			}
+
+			// heads too old to match the newest head can't match anything that arrives later either:
+			bool matched = true;
+			for (int i=0; i<n; i++) {
+				if (queues[i].front().timestamp < newest - tolerance) {
+					queues[i].pop_front();
+					dropped++;
+					matched = false;
+				}
+			}
+			if (!matched) continue;
+
+			// a set released earlier in this call is superseded:
+			if (found) dropped += n;
+			out.resize(n);
+			double oldest = newest;
+			for (int i=0; i<n; i++) {
+				oldest = std::min(oldest, queues[i].front().timestamp);
+				out[i] = queues[i].front().frame;
+				queues[i].pop_front();
+			}
+			if (spread) *spread = newest - oldest;
+			found = true;
+		}
+	}
+
+	void clear() {
+		for (std::deque<Entry>& q : queues) q.clear();
+	}
+
+private:
+
+	struct Entry {
+		double timestamp;
+		Frame frame;
+	};
+
+	std::vector<std::deque<Entry> > queues;
+};
+
+#endif // REALSENSE_SYNC_H
@@ -0,0 +1,84 @@
+/*
+	Checks that pixels rejected by reject_flying_z16 get no index from any variant of the point kernel.
+	Needs only the headers, not librealsense or node:
+
+		g++ -std=c++11 -I. test/flying_pixels.cpp -o flying_pixels && ./flying_pixels
+*/
+
+#include <stdio.h>
+#include <vector>
+
+#include "kernels.h"
+
+int failures = 0;
+
+void check(bool ok, const char * what) {
+	if (!ok) {
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+// run a point kernel on one row, returning the indices it kept
+std::vector<uint32_t> kernel_indices(PointKernel kernel, const PointKernelParams& k, const std::vector<uint16_t>& row) {
+	const int n = int(row.size());
+	std::vector<float> rx(n), ry(n);
+	for (int x=0; x<n; x++) {
+		rx[x] = (x - n/2) * 0.01f;
+		ry[x] = 0.f;
+	}
+	std::vector<glm::vec3> vertices(n);
+	// the SIMD kernels may store a few lanes past the last index:
+	std::vector<uint32_t> indices(n + 8);
+	const uint32_t count = kernel(k, row.data(), rx.data(), ry.data(), n, 0, vertices.data(), indices.data());
+	indices.resize(count);
+	return indices;
+}
+
+int main() {
+	// a step from foreground to background, with a flying pixel between, and a pixel with no reading at the end:
+	std::vector<uint16_t> depth(24, 1000);
+	depth[6] = 2000;
+	for (int x=7; x<23; x++) depth[x] = 3000;
+	depth[23] = 0;
+
+	const uint16_t ratio = uint16_t(0.05f * 65536.f);
+	std::vector<uint16_t> row(depth.size());
+	reject_flying_z16(nullptr, depth.data(), nullptr, int(depth.size()), ratio, row.data());
+	check(row[5] == 0 && row[6] == 0 && row[7] == 0, "pixels either side of the jumps are rejected");
+	check(row[4] == 1000 && row[8] == 3000, "pixels away from the jumps are kept");
+
+	glm::mat4 moved(1.f);
+	moved[3] = glm::vec4(0.5f, 0.2f, -1.f, 1.f);
+	const glm::mat4 transforms[2] = { glm::mat4(1.f), moved };
+	for (int t=0; t<2; t++) {
+		const PointKernelParams k(transforms[t], glm::vec3(-10.f), glm::vec3(10.f), 0.001f, true, true);
+		PointKernel kernels[3] = {
+			point_kernel_scalar<false, true, true>,
+		#ifdef KERNELS_X86
+			point_kernel_sse41<false, true, true>,
+			point_kernel_avx2<false, true, true>,
+		#else
+			point_kernel_scalar<false, true, true>,
+			point_kernel_scalar<false, true, true>,
+		#endif
+		};
+		for (int level=0; level<=int(simd_level()); level++) {
+			std::vector<bool> kept(row.size(), false);
+			for (uint32_t i : kernel_indices(kernels[level], k, row)) kept[i] = true;
+			bool ok = true;
+			for (size_t x=0; x<row.size(); x++) ok = ok && (kept[x] == (row[x] != 0));
+			check(ok, "exactly the pixels with depth are indexed");
+		}
+		std::vector<bool> kept(row.size(), false);
+		for (uint32_t i : kernel_indices(point_kernel(k), k, row)) kept[i] = true;
+		check(!kept[5] && !kept[6] && !kept[7] && !kept[23], "point_kernel() drops rejected pixels");
+	}
+
+	// without rejection, pixels with no reading are still indexed as before:
+	const PointKernelParams keep(glm::mat4(1.f), glm::vec3(-10.f), glm::vec3(10.f), 0.001f);
+	check(kernel_indices(point_kernel(keep), keep, row).size() == row.size(), "zero depths are kept without rejection");
+
+	if (!failures) printf("ok\n");
+	return failures ? 1 : 0;
+}
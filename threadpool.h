@@ -0,0 +1,164 @@
+#ifndef REALSENSE_THREADPOOL_H
+#define REALSENSE_THREADPOOL_H
+
+/*
+	A small persistent thread pool for splitting per-frame work into bands.
+
+	parallel_for() may be called from any thread (the main thread, capture threads, the libuv threadpool),
+	including from several at once. The calling thread works on its own job too, so a job always
+	completes even if every worker is busy, or the pool has no workers at all.
+*/
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+public:
+
+	ThreadPool(int concurrency = 0) {
+		resize(concurrency);
+	}
+
+	~ThreadPool() {
+		std::lock_guard<std::mutex> lock(resize_mutex);
+		stop_workers();
+	}
+
+	// total number of threads that can work on one job, including the caller
+	int size() const {
+		return num_workers.load() + 1;
+	}
+
+	// concurrency <= 0 means one thread per hardware core
+	// must not be called from inside a job, but other threads may keep calling parallel_for() meanwhile
+	// (jobs started while the workers are being replaced are finished by their calling threads)
+	void resize(int concurrency) {
+		if (concurrency <= 0) concurrency = std::max(1u, std::thread::hardware_concurrency());
+		std::lock_guard<std::mutex> lock(resize_mutex);
+		stop_workers();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = false;
+		}
+		for (int i=1; i<concurrency; i++) {
+			workers.push_back(std::thread(&ThreadPool::worker_loop, this));
+		}
+		num_workers = int(workers.size());
+	}
+
+	// call fn(task) for each task in [0, num_tasks), and return when all have completed
+	void parallel_for(int num_tasks, const std::function<void(int)>& fn) {
+		if (num_tasks <= 0) return;
+		if (num_tasks == 1 || num_workers.load() == 0) {
+			for (int i=0; i<num_tasks; i++) fn(i);
+			return;
+		}
+
+		Job job(fn, num_tasks);
+		std::list<Job *>::iterator it;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			it = jobs.insert(jobs.end(), &job);
+		}
+		work_cv.notify_all();
+
+		// help out with our own job:
+		while (true) {
+			int task;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (job.next >= job.count) break;
+				task = job.next++;
+				if (job.next == job.count) jobs.erase(it);
+			}
+			run(job, task);
+		}
+
+		// wait for workers to finish the tasks they claimed:
+		std::unique_lock<std::mutex> lock(mutex);
+		done_cv.wait(lock, [&job]() { return job.done == job.count; });
+	}
+
+	// split [0, n) into `bands` contiguous ranges, returning the range of `band`
+	static void band_range(int band, int bands, int n, int& start, int& end) {
+		start = int((int64_t(n) * band) / bands);
+		end = int((int64_t(n) * (band + 1)) / bands);
+	}
+
+	// a reasonable number of bands to split n items into:
+	// a few per thread to balance uneven work, but no fewer than min_items each
+	int bands_for(int n, int min_items) const {
+		int bands = size() * 4;
+		if (min_items > 0) bands = std::min(bands, n / min_items);
+		return std::max(bands, 1);
+	}
+
+private:
+
+	struct Job {
+		const std::function<void(int)>& fn;
+		int count;
+		int next = 0;	// guarded by the pool mutex
+		int done = 0;	// guarded by the pool mutex
+
+		Job(const std::function<void(int)>& fn, int count) : fn(fn), count(count) {}
+	};
+
+	void run(Job& job, int task) {
+		job.fn(task);
+		std::lock_guard<std::mutex> lock(mutex);
+		if (++job.done == job.count) done_cv.notify_all();
+	}
+
+	void worker_loop() {
+		while (true) {
+			Job * job;
+			int task;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				work_cv.wait(lock, [this]() { return stopping || !jobs.empty(); });
+				if (stopping) return;
+				job = jobs.front();
+				task = job->next++;
+				if (job->next == job->count) jobs.pop_front();
+			}
+			run(*job, task);
+		}
+	}
+
+	// (called with resize_mutex held)
+	void stop_workers() {
+		num_workers = 0;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		work_cv.notify_all();
+		for (std::thread& t : workers) t.join();
+		workers.clear();
+	}
+
+	// `workers` is only touched under resize_mutex; other threads read num_workers instead
+	std::vector<std::thread> workers;
+	std::atomic<int> num_workers { 0 };
+	std::mutex resize_mutex;
+	std::list<Job *> jobs;
+	std::mutex mutex;
+	std::condition_variable work_cv, done_cv;
+	bool stopping = false;
+};
+
+// the pool shared by all cameras
+inline ThreadPool& thread_pool() {
+	static ThreadPool pool;
+	return pool;
+}
+
+#endif // REALSENSE_THREADPOOL_H
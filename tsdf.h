@@ -0,0 +1,114 @@
+#ifndef REALSENSE_TSDF_H
+#define REALSENSE_TSDF_H
+
+/*
+	Truncated signed distance fusion of depth frames into a dense voxel grid.
+
+	Each voxel holds the running weighted average of its distance to the observed surface, measured along the
+	camera's view axis and divided by the truncation distance, so it lies in [-1, 1]: positive in front of the
+	surface, negative behind it. The surface is the zero crossing. Voxels that no camera has seen have weight 0.
+
+	Frames are given as the vertex grids the cameras produce (one vertex per depth pixel, already transformed
+	into world space), together with the transform and pinhole intrinsics that made them. Lens distortion is
+	ignored, as the depth streams of the D400 series report none.
+*/
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+#include "al_glm.h"
+#include "threadpool.h"
+
+struct TsdfParams {
+	// grid size, and the world-space position of the corner of voxel (0,0,0)
+	glm::ivec3 dim = glm::ivec3(128, 128, 128);
+	glm::vec3 origin = glm::vec3(-1.28f, -1.28f, -1.28f);
+	float voxel_size = 0.02f;
+	// distance either side of the surface over which voxels are updated
+	float truncation = 0.06f;
+	// cap on the accumulated weight, so that the volume can still follow changes
+	float max_weight = 64.f;
+};
+
+// one depth frame, as a grid of world-space vertices
+struct DepthView {
+	const glm::vec3 * vertices = nullptr;
+	int width = 0, height = 0;
+	// maps the camera space (in opengl convention: y up, looking down -z) to world space
+	glm::mat4 transform;
+	float fx = 0, fy = 0, ppx = 0, ppy = 0;
+};
+
+// Holds the scratch memory for integration, so that it can be reused from frame to frame.
+class TsdfIntegrator {
+public:
+
+	// Fuse a frame into `tsdf` and `weights` (both dim.x*dim.y*dim.z, x fastest), in parallel z slabs.
+	void integrate(const TsdfParams& p, const DepthView& view, float * tsdf, float * weights) {
+		ThreadPool& pool = thread_pool();
+		const int width = view.width, height = view.height;
+		if (width <= 0 || height <= 0 || !view.vertices) return;
+		const glm::mat4 world2cam = glm::inverse(view.transform);
+
+		// recover the depth of each pixel (0 where there was no reading, as those vertices sit at the camera origin):
+		depth.resize(size_t(width) * height);
+		const glm::vec4 zrow = glm::row(world2cam, 2);
+		const int bands = pool.bands_for(height, 8);
+		pool.parallel_for(bands, [&](int band) {
+			int y0, y1;
+			ThreadPool::band_range(band, bands, height, y0, y1);
+			for (int i=y0*width; i<y1*width; i++) {
+				const glm::vec3& v = view.vertices[i];
+				depth[i] = -(zrow.x*v.x + zrow.y*v.y + zrow.z*v.z + zrow.w);
+			}
+		});
+
+		// camera-space position of voxel (0,0,0)'s center, and the steps along each axis:
+		const glm::vec3 start = glm::vec3(world2cam * glm::vec4(p.origin + 0.5f*p.voxel_size, 1.f));
+		const glm::vec3 dx = glm::vec3(world2cam * glm::vec4(p.voxel_size, 0.f, 0.f, 0.f));
+		const glm::vec3 dy = glm::vec3(world2cam * glm::vec4(0.f, p.voxel_size, 0.f, 0.f));
+		const glm::vec3 dz = glm::vec3(world2cam * glm::vec4(0.f, 0.f, p.voxel_size, 0.f));
+		const float inv_trunc = 1.f / p.truncation;
+		const size_t slab_size = size_t(p.dim.x) * p.dim.y;
+
+		const int slabs = pool.bands_for(p.dim.z, 1);
+		pool.parallel_for(slabs, [&](int slab) {
+			int z0, z1;
+			ThreadPool::band_range(slab, slabs, p.dim.z, z0, z1);
+			for (int z=z0; z<z1; z++) {
+				for (int y=0; y<p.dim.y; y++) {
+					const size_t row = z*slab_size + size_t(y)*p.dim.x;
+					glm::vec3 c = start + float(y)*dy + float(z)*dz;
+					for (int x=0; x<p.dim.x; x++, c += dx) {
+						// intel camera space: y down, z forward
+						const float cz = -c.z;
+						if (cz <= 0.f) continue;
+						const float inv_z = 1.f / cz;
+						// nearest pixel (range-checked as floats, as the projection can be huge near the camera plane):
+						const float pu = c.x * inv_z * view.fx + view.ppx + 0.5f;
+						const float pv = -c.y * inv_z * view.fy + view.ppy + 0.5f;
+						if (!(pu >= 0.f && pu < width && pv >= 0.f && pv < height)) continue;
+						const float d = depth[int(pv)*width + int(pu)];
+						if (d <= 0.f) continue;
+
+						const float sdf = d - cz;
+						if (sdf < -p.truncation) continue;	// hidden behind the surface
+						const float value = std::min(1.f, sdf * inv_trunc);
+
+						const size_t i = row + x;
+						const float w = weights[i];
+						tsdf[i] = (tsdf[i]*w + value) / (w + 1.f);
+						weights[i] = std::min(w + 1.f, p.max_weight);
+					}
+				}
+			}
+		});
+	}
+
+private:
+
+	std::vector<float> depth;
+};
+
+#endif // REALSENSE_TSDF_H
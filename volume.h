@@ -0,0 +1,285 @@
+#ifndef REALSENSE_VOLUME_H
+#define REALSENSE_VOLUME_H
+
+/*
+	A sparse voxel volume, stored as 8x8x8 bricks in a spatial hash.
+
+	Bricks are allocated as points land in them, and freed again once they have decayed to nothing, so memory
+	follows the occupied surfaces rather than the bounding box. Voxel (x,y,z) covers world space
+	[x, x+1) * voxel_size (etc.), and brick (bx,by,bz) holds voxels [bx*8, bx*8+8) (etc.).
+	Within a brick, voxels are stored x fastest, then y, then z.
+
+	Not thread-safe. Mapping points to voxels, decay and export use the shared thread pool internally;
+	finding or allocating each point's brick and adding to it is a single serial pass, as it changes the hash.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+#include "al_glm.h"
+#include "threadpool.h"
+#include "voxels.h"
+
+class SparseVolume {
+public:
+
+	enum {
+		BRICK_BITS = 3,
+		BRICK_DIM = 1 << BRICK_BITS,
+		BRICK_VOXELS = BRICK_DIM * BRICK_DIM * BRICK_DIM
+	};
+
+	struct Brick {
+		glm::ivec3 coord;
+		// largest value in the brick after the last decay, for freeing empty bricks
+		float peak;
+		bool active;
+	};
+
+	float voxel_size;
+
+	SparseVolume(float voxel_size = 0.02f) : voxel_size(voxel_size) {}
+
+	// number of allocated bricks
+	size_t size() const {
+		return lookup.size();
+	}
+
+	void clear() {
+		lookup.clear();
+		bricks.clear();
+		data.clear();
+		free_list.clear();
+	}
+
+	// Add `add` to the voxel that each point lands in, allocating bricks as needed.
+	// `mat` maps the point coordinates into the world space of the volume.
+	// Returns the number of points added.
+	uint32_t splat(const PointSource * sources, int num_sources, const glm::mat4& mat, float add) {
+		ThreadPool& pool = thread_pool();
+		const float inv_size = 1.f / voxel_size;
+
+		// split the sources into chunks of points:
+		chunks.clear();
+		size_t total_points = 0;
+		for (int s=0; s<num_sources; s++) {
+			const int n = sources[s].count;
+			const int bands = pool.bands_for(n, 4096);
+			for (int band=0; band<bands; band++) {
+				Chunk chunk;
+				chunk.source = s;
+				ThreadPool::band_range(band, bands, n, chunk.start, chunk.end);
+				chunk.first = total_points + chunk.start;
+				chunks.push_back(chunk);
+			}
+			total_points += n;
+		}
+		voxel_coords.resize(total_points);
+
+		// find the voxel of each point:
+		pool.parallel_for(int(chunks.size()), [&](int c) {
+			const Chunk& chunk = chunks[c];
+			const PointSource& src = sources[chunk.source];
+			glm::ivec3 * out = &voxel_coords[chunk.first];
+			for (int idx=chunk.start; idx<chunk.end; idx++) {
+				const glm::vec4 v = mat * glm::vec4(src.vertices[src.indices[idx]], 1.f);
+				*out++ = glm::ivec3(glm::floor(glm::vec3(v) * inv_size));
+			}
+		});
+
+		// find or allocate the brick of each point, and add to its voxel
+		// (this has to be serial, as it changes the hash, so the add is done here too rather than in a second pass over the points;
+		// neighbouring pixels mostly land in the same brick, so the last lookup is remembered)
+		uint64_t last_key = 0;
+		uint32_t last_brick = INVALID;
+		uint32_t total = 0;
+		for (size_t i=0; i<total_points; i++) {
+			const glm::ivec3& v = voxel_coords[i];
+			const glm::ivec3 b = brick_of(v);
+			const uint64_t key = brick_key(b);
+			if (key == INVALID_KEY) continue;
+			if (last_brick == INVALID || key != last_key) {
+				last_key = key;
+				last_brick = allocate(b, key);
+			}
+			const glm::ivec3 local = v - b * int(BRICK_DIM);
+			data[(size_t(last_brick) << (3*BRICK_BITS)) + local.x + BRICK_DIM*(local.y + BRICK_DIM*local.z)] += add;
+			total++;
+		}
+		return total;
+	}
+
+	// Multiply every voxel by `mul`, and free bricks whose voxels are all at or below `threshold`.
+	void decay(float mul, float threshold) {
+		ThreadPool& pool = thread_pool();
+		const int num_bricks = int(bricks.size());
+		const int bands = pool.bands_for(num_bricks, 16);
+		pool.parallel_for(bands, [&](int band) {
+			int start, end;
+			ThreadPool::band_range(band, bands, num_bricks, start, end);
+			for (int b=start; b<end; b++) {
+				Brick& brick = bricks[b];
+				if (!brick.active) continue;
+				float * voxels = &data[size_t(b) * BRICK_VOXELS];
+				float peak = 0.f;
+				for (int i=0; i<BRICK_VOXELS; i++) {
+					voxels[i] *= mul;
+					peak = std::max(peak, voxels[i]);
+				}
+				brick.peak = peak;
+			}
+		});
+
+		for (int b=0; b<num_bricks; b++) {
+			Brick& brick = bricks[b];
+			if (brick.active && brick.peak <= threshold) {
+				lookup.erase(brick_key(brick.coord));
+				brick.active = false;
+				free_list.push_back(b);
+			}
+		}
+	}
+
+	// Copy the voxels in [origin, origin + dim) into a dense grid (x fastest), with zeros where there are no bricks.
+	void export_dense(float * out, glm::ivec3 origin, glm::ivec3 dim) const {
+		ThreadPool& pool = thread_pool();
+		const int bands = pool.bands_for(dim.z, 1);
+		pool.parallel_for(bands, [&](int band) {
+			int z0, z1;
+			ThreadPool::band_range(band, bands, dim.z, z0, z1);
+			export_block(out + size_t(z0) * dim.y * dim.x, origin + glm::ivec3(0, 0, z0), glm::ivec3(dim.x, dim.y, z1 - z0));
+		});
+	}
+
+	// As export_dense, but on the calling thread, for small blocks.
+	void export_block(float * out, glm::ivec3 origin, glm::ivec3 dim) const {
+		for (int z=0; z<dim.z; z++) {
+			for (int y=0; y<dim.y; y++) {
+				float * row = out + (size_t(z) * dim.y + y) * dim.x;
+				int x = 0;
+				while (x < dim.x) {
+					// copy the run of the row that lies within one brick:
+					const glm::ivec3 v = origin + glm::ivec3(x, y, z);
+					const glm::ivec3 b = brick_of(v);
+					const glm::ivec3 local = v - b * int(BRICK_DIM);
+					const int run = std::min(BRICK_DIM - local.x, dim.x - x);
+					const float * src = find(b);
+					if (src) {
+						memcpy(row + x, src + local.x + BRICK_DIM*(local.y + BRICK_DIM*local.z), run * sizeof(float));
+					} else {
+						memset(row + x, 0, run * sizeof(float));
+					}
+					x += run;
+				}
+			}
+		}
+	}
+
+	// Write the coordinates (3 ints each) and voxels (BRICK_VOXELS floats each) of up to `max_bricks` active bricks.
+	// Returns the number written.
+	size_t export_bricks(int32_t * coords, float * voxels, size_t max_bricks) const {
+		size_t count = 0;
+		for (size_t b=0; b<bricks.size() && count < max_bricks; b++) {
+			if (!bricks[b].active) continue;
+			coords[count*3+0] = bricks[b].coord.x;
+			coords[count*3+1] = bricks[b].coord.y;
+			coords[count*3+2] = bricks[b].coord.z;
+			memcpy(voxels + count*BRICK_VOXELS, &data[b * BRICK_VOXELS], BRICK_VOXELS * sizeof(float));
+			count++;
+		}
+		return count;
+	}
+
+	// the coordinates of the allocated bricks
+	void active_bricks(std::vector<glm::ivec3>& out) const {
+		out.clear();
+		for (const Brick& brick : bricks) {
+			if (brick.active) out.push_back(brick.coord);
+		}
+	}
+
+	// the range of voxels [lo, hi) covered by the allocated bricks; returns false if there are none
+	bool bounds(glm::ivec3& lo, glm::ivec3& hi) const {
+		if (lookup.empty()) return false;
+		lo = glm::ivec3(INT32_MAX);
+		hi = glm::ivec3(INT32_MIN);
+		for (const Brick& brick : bricks) {
+			if (!brick.active) continue;
+			lo = glm::min(lo, brick.coord);
+			hi = glm::max(hi, brick.coord);
+		}
+		lo *= int(BRICK_DIM);
+		hi = (hi + 1) * int(BRICK_DIM);
+		return true;
+	}
+
+	// the voxels of brick b, or nullptr if it is not allocated
+	const float * find(glm::ivec3 b) const {
+		auto it = lookup.find(brick_key(b));
+		return (it == lookup.end()) ? nullptr : &data[size_t(it->second) * BRICK_VOXELS];
+	}
+
+	static glm::ivec3 brick_of(glm::ivec3 v) {
+		// arithmetic shift rounds toward -infinity, as floor division should
+		return glm::ivec3(v.x >> BRICK_BITS, v.y >> BRICK_BITS, v.z >> BRICK_BITS);
+	}
+
+private:
+
+	static const uint32_t INVALID = 0xffffffff;
+	static const uint64_t INVALID_KEY = ~uint64_t(0);
+	static const int KEY_BITS = 21;
+
+	// pack signed brick coordinates into a hash key, 21 bits per axis
+	static uint64_t brick_key(glm::ivec3 b) {
+		const int32_t limit = 1 << (KEY_BITS - 1);
+		if (b.x < -limit || b.x >= limit || b.y < -limit || b.y >= limit || b.z < -limit || b.z >= limit) return INVALID_KEY;
+		const uint64_t mask = (uint64_t(1) << KEY_BITS) - 1;
+		return (uint64_t(b.x + limit) & mask)
+			| ((uint64_t(b.y + limit) & mask) << KEY_BITS)
+			| ((uint64_t(b.z + limit) & mask) << (2*KEY_BITS));
+	}
+
+	// the index of brick b, allocating (and zeroing) it if needed
+	uint32_t allocate(glm::ivec3 b, uint64_t key) {
+		auto it = lookup.find(key);
+		if (it != lookup.end()) return it->second;
+
+		uint32_t index;
+		if (!free_list.empty()) {
+			index = free_list.back();
+			free_list.pop_back();
+			memset(&data[size_t(index) * BRICK_VOXELS], 0, BRICK_VOXELS * sizeof(float));
+		} else {
+			index = uint32_t(bricks.size());
+			bricks.push_back(Brick());
+			data.resize(data.size() + BRICK_VOXELS, 0.f);
+		}
+		Brick& brick = bricks[index];
+		brick.coord = b;
+		brick.peak = 0.f;
+		brick.active = true;
+		lookup[key] = index;
+		return index;
+	}
+
+	struct Chunk {
+		int source;
+		int start, end;	// range of the source's indices
+		size_t first;	// offset of the chunk in `voxel_coords`
+	};
+
+	std::unordered_map<uint64_t, uint32_t> lookup;
+	std::vector<Brick> bricks;
+	std::vector<float> data;	// BRICK_VOXELS per brick
+	std::vector<uint32_t> free_list;
+
+	// scratch memory for splat():
+	std::vector<Chunk> chunks;
+	std::vector<glm::ivec3> voxel_coords;
+};
+
+#endif // REALSENSE_VOLUME_H
@@ -0,0 +1,423 @@
+#ifndef REALSENSE_VOXELS_H
+#define REALSENSE_VOXELS_H
+
+/*
+	Splatting point clouds into dense voxel grids, in parallel.
+
+	Points are binned by the z slab of the grid they land in, so that each slab can then be written by one
+	thread without atomics or per-thread copies of the grid. The decay of a slab is done by the same thread
+	just before its points are added, so the voxel memory is swept once per call.
+
+	Grids can be stored as float32, or more compactly as uint8, uint16 or half floats (see the Voxel* formats).
+	The integer formats saturate rather than overflow, and decay in fixed point (rounding down).
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "al_glm.h"
+#include "kernels.h"
+#include "threadpool.h"
+
+// the points of one cloud that should be splatted: vertices[indices[0..count)]
+struct PointSource {
+	const glm::vec3 * vertices = nullptr;
+	const uint32_t * indices = nullptr;
+	uint32_t count = 0;
+};
+
+// IEEE half float conversions, rounding to nearest even
+inline float half_to_float(uint16_t h) {
+	const uint32_t sign = uint32_t(h & 0x8000) << 16;
+	uint32_t exponent = (h >> 10) & 0x1f;
+	uint32_t mantissa = h & 0x3ff;
+	uint32_t bits;
+	if (exponent == 0x1f) {
+		bits = sign | 0x7f800000 | (mantissa << 13);	// inf or nan
+	} else if (exponent) {
+		bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+	} else if (mantissa) {
+		// subnormal: normalize it
+		exponent = 113;
+		while (!(mantissa & 0x400)) {
+			mantissa <<= 1;
+			exponent--;
+		}
+		bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+	} else {
+		bits = sign;
+	}
+	float f;
+	memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+inline uint16_t float_to_half(float f) {
+	uint32_t bits;
+	memcpy(&bits, &f, sizeof(bits));
+	const uint16_t sign = (bits >> 16) & 0x8000;
+	const uint32_t abs = bits & 0x7fffffff;
+	if (abs >= 0x7f800000) return sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 : 0);	// inf or nan
+	if (abs >= 0x477ff000) return sign | 0x7c00;	// rounds to beyond the largest half
+	if (abs < 0x38800000) {
+		// subnormal or zero
+		if (abs < 0x33000000) return sign;
+		const uint32_t shift = 126 - (abs >> 23);
+		const uint32_t mantissa = (abs & 0x7fffff) | 0x800000;
+		uint32_t h = mantissa >> shift;
+		const uint32_t rest = mantissa & ((1u << shift) - 1), half = 1u << (shift - 1);
+		if (rest > half || (rest == half && (h & 1))) h++;
+		return sign | h;
+	}
+	uint32_t h = ((abs - 0x38000000) >> 13);
+	const uint32_t rest = abs & 0x1fff;
+	if (rest > 0x1000 || (rest == 0x1000 && (h & 1))) h++;
+	return sign | h;
+}
+
+// Fixed-point multiplier for decaying integer voxels: v * mul is (v * m) >> 16, rounding down.
+// Only valid for 0 <= mul < 1 (see decay_fixed).
+inline uint16_t fixed_multiplier(float mul) {
+	return uint16_t(std::min(65535.f, std::max(0.f, mul * 65536.f)));
+}
+
+// Storage formats for voxel grids: the stored type, how to decay a run of voxels, and how to add to one.
+// `add` is in the units of the stored type (i.e. 0..255 for uint8).
+
+struct VoxelF32 {
+	typedef float type;
+	typedef float add_type;
+	static add_type make_add(float add) { return add; }
+	static void add(float& v, add_type a) { v += a; }
+	static void decay(float * v, size_t n, float mul) {
+		for (size_t i=0; i<n; i++) v[i] *= mul;
+	}
+};
+
+template<typename T, int MAX>
+struct VoxelFixed {
+	typedef T type;
+	typedef int32_t add_type;
+	static add_type make_add(float add) {
+		return int32_t(std::min(float(MAX), std::max(-float(MAX), roundf(add))));
+	}
+	static void add(T& v, add_type a) {
+		v = T(std::min(MAX, std::max(0, int32_t(v) + a)));
+	}
+	static void decay(T * v, size_t n, float mul) {
+		if (mul >= 1.f) {
+			// growth saturates
+			for (size_t i=0; i<n; i++) v[i] = T(std::min(float(MAX), floorf(v[i] * mul)));
+			return;
+		}
+		decay_fixed(v, n, fixed_multiplier(mul));
+	}
+	static void decay_fixed(T * v, size_t n, uint16_t m);
+};
+
+typedef VoxelFixed<uint8_t, 255> VoxelU8;
+typedef VoxelFixed<uint16_t, 65535> VoxelU16;
+
+// half floats, stored as uint16
+struct VoxelF16 {
+	typedef uint16_t type;
+	typedef float add_type;
+	static add_type make_add(float add) { return add; }
+	static void add(uint16_t& v, add_type a) { v = float_to_half(half_to_float(v) + a); }
+	static void decay(uint16_t * v, size_t n, float mul);
+};
+
+#ifdef KERNELS_X86
+
+KERNELS_TARGET_SSE41 inline size_t decay_u8_sse41(uint8_t * v, size_t n, uint16_t m) {
+	const __m128i vm = _mm_set1_epi16(short(m));
+	const __m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+	for (; i+16<=n; i+=16) {
+		const __m128i x = _mm_loadu_si128((const __m128i *)(v + i));
+		const __m128i lo = _mm_mulhi_epu16(_mm_unpacklo_epi8(x, zero), vm);
+		const __m128i hi = _mm_mulhi_epu16(_mm_unpackhi_epi8(x, zero), vm);
+		_mm_storeu_si128((__m128i *)(v + i), _mm_packus_epi16(lo, hi));
+	}
+	return i;
+}
+
+KERNELS_TARGET_AVX2 inline size_t decay_u8_avx2(uint8_t * v, size_t n, uint16_t m) {
+	const __m256i vm = _mm256_set1_epi16(short(m));
+	const __m256i zero = _mm256_setzero_si256();
+	size_t i = 0;
+	for (; i+32<=n; i+=32) {
+		const __m256i x = _mm256_loadu_si256((const __m256i *)(v + i));
+		// unpack and pack both work within 128-bit lanes, so the order is restored
+		const __m256i lo = _mm256_mulhi_epu16(_mm256_unpacklo_epi8(x, zero), vm);
+		const __m256i hi = _mm256_mulhi_epu16(_mm256_unpackhi_epi8(x, zero), vm);
+		_mm256_storeu_si256((__m256i *)(v + i), _mm256_packus_epi16(lo, hi));
+	}
+	return i;
+}
+
+KERNELS_TARGET_SSE41 inline size_t decay_u16_sse41(uint16_t * v, size_t n, uint16_t m) {
+	const __m128i vm = _mm_set1_epi16(short(m));
+	size_t i = 0;
+	for (; i+8<=n; i+=8) {
+		const __m128i x = _mm_loadu_si128((const __m128i *)(v + i));
+		_mm_storeu_si128((__m128i *)(v + i), _mm_mulhi_epu16(x, vm));
+	}
+	return i;
+}
+
+KERNELS_TARGET_AVX2 inline size_t decay_u16_avx2(uint16_t * v, size_t n, uint16_t m) {
+	const __m256i vm = _mm256_set1_epi16(short(m));
+	size_t i = 0;
+	for (; i+16<=n; i+=16) {
+		const __m256i x = _mm256_loadu_si256((const __m256i *)(v + i));
+		_mm256_storeu_si256((__m256i *)(v + i), _mm256_mulhi_epu16(x, vm));
+	}
+	return i;
+}
+
+// 8 half floats at a time (only used if the CPU reports F16C, see simd_f16c)
+KERNELS_TARGET_AVX2_F16C inline size_t decay_f16_avx2(uint16_t * v, size_t n, float mul) {
+	const __m256 vm = _mm256_set1_ps(mul);
+	size_t i = 0;
+	for (; i+8<=n; i+=8) {
+		const __m256 x = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(v + i)));
+		_mm_storeu_si128((__m128i *)(v + i), _mm256_cvtps_ph(_mm256_mul_ps(x, vm), _MM_FROUND_TO_NEAREST_INT));
+	}
+	return i;
+}
+
+#endif // KERNELS_X86
+
+template<>
+inline void VoxelFixed<uint8_t, 255>::decay_fixed(uint8_t * v, size_t n, uint16_t m) {
+	size_t i = 0;
+#ifdef KERNELS_X86
+	const SimdLevel simd = simd_level();
+	if (simd == SIMD_AVX2) i = decay_u8_avx2(v, n, m);
+	else if (simd == SIMD_SSE41) i = decay_u8_sse41(v, n, m);
+#endif
+	for (; i<n; i++) v[i] = uint8_t((uint32_t(v[i]) * m) >> 16);
+}
+
+template<>
+inline void VoxelFixed<uint16_t, 65535>::decay_fixed(uint16_t * v, size_t n, uint16_t m) {
+	size_t i = 0;
+#ifdef KERNELS_X86
+	const SimdLevel simd = simd_level();
+	if (simd == SIMD_AVX2) i = decay_u16_avx2(v, n, m);
+	else if (simd == SIMD_SSE41) i = decay_u16_sse41(v, n, m);
+#endif
+	for (; i<n; i++) v[i] = uint16_t((uint32_t(v[i]) * m) >> 16);
+}
+
+inline void VoxelF16::decay(uint16_t * v, size_t n, float mul) {
+	size_t i = 0;
+#ifdef KERNELS_X86
+	if (simd_level() == SIMD_AVX2 && simd_f16c()) i = decay_f16_avx2(v, n, mul);
+#endif
+	for (; i<n; i++) v[i] = float_to_half(half_to_float(v[i]) * mul);
+}
+
+// How a dense grid of dim.x * dim.y * dim.z voxels is laid out in memory.
+// Linear is x fastest, then y, then z. Tiled stores 8x8x8 tiles (x fastest, then y, then z), 
+// each holding its voxels in Morton (Z-curve) order, so that neighbouring voxels are mostly close in memory. 
+// A tiled grid is padded up to whole tiles. 
+struct VoxelLayout {
+	enum { TILE_BITS = 3, TILE_DIM = 1 << TILE_BITS, TILE_VOXELS = TILE_DIM * TILE_DIM * TILE_DIM };
+
+	glm::ivec3 dim;
+	bool tiled;
+
+	VoxelLayout(glm::ivec3 dim, bool tiled = false) : dim(dim), tiled(tiled) {}
+
+	glm::ivec3 tiles() const {
+		return (dim + int(TILE_DIM - 1)) / int(TILE_DIM);
+	}
+
+	// number of voxels stored, including any padding
+	size_t size() const {
+		if (!tiled) return size_t(dim.x) * dim.y * dim.z;
+		const glm::ivec3 t = tiles();
+		return size_t(t.x) * t.y * t.z * TILE_VOXELS;
+	}
+
+	size_t index(int x, int y, int z) const {
+		if (!tiled) return x + size_t(y)*dim.x + size_t(z)*dim.x*dim.y;
+		const glm::ivec3 t = tiles();
+		const size_t tile = (x >> TILE_BITS) + size_t(y >> TILE_BITS)*t.x + size_t(z >> TILE_BITS)*t.x*t.y;
+		return tile*TILE_VOXELS + morton(x & (TILE_DIM-1), y & (TILE_DIM-1), z & (TILE_DIM-1));
+	}
+
+	// Memory is contiguous per group of z layers (1 layer if linear, a layer of tiles if tiled), 
+	// so the grid can be split into slabs at multiples of this: 
+	int layers_per_group() const {
+		return tiled ? TILE_DIM : 1;
+	}
+
+	size_t group_size() const {
+		if (!tiled) return size_t(dim.x) * dim.y;
+		const glm::ivec3 t = tiles();
+		return size_t(t.x) * t.y * TILE_VOXELS;
+	}
+
+	// interleave the bits of a position within a tile
+	static uint32_t morton(int x, int y, int z) {
+		static const uint32_t spread[TILE_DIM] = { 0x0, 0x1, 0x8, 0x9, 0x40, 0x41, 0x48, 0x49 };
+		return spread[x] | (spread[y] << 1) | (spread[z] << 2);
+	}
+};
+
+// Copy a grid from any layout to a linear one, e.g. for uploading as a 3D texture.
+// T is the storage type of the format (float, uint8_t or uint16_t; half floats are copied as their bits).
+template<typename T>
+inline void voxels_to_linear(const T * src, const VoxelLayout& layout, T * dst) {
+	const glm::ivec3 dim = layout.dim;
+	ThreadPool& pool = thread_pool();
+	const int bands = pool.bands_for(dim.z, 1);
+	pool.parallel_for(bands, [&](int band) {
+		int z0, z1;
+		ThreadPool::band_range(band, bands, dim.z, z0, z1);
+		for (int z=z0; z<z1; z++) {
+			for (int y=0; y<dim.y; y++) {
+				T * row = dst + (size_t(z)*dim.y + y)*dim.x;
+				for (int x=0; x<dim.x; x++) row[x] = src[layout.index(x, y, z)];
+			}
+		}
+	});
+}
+
+// Holds the scratch memory for splatting, so that it can be reused from frame to frame.
+class VoxelSplatter {
+public:
+
+	// Multiply every voxel by `mul` (if `decay` is set), then add `add` to the voxel each point lands in,
+	// for a grid stored in the given Format (e.g. VoxelF32).
+	// Points are mapped by `mat` into the unit cube of the grid.
+	// `num_voxels` may exceed the size of the layout, in which case the extra voxels are only decayed
+	// (a linear grid may also be short of it, in which case the missing z layers are ignored).
+	// Returns the number of points that landed in the grid.
+	template<typename Format>
+	uint32_t splat(typename Format::type * voxels, size_t num_voxels, const VoxelLayout& layout, const glm::mat4& mat,
+		const PointSource * sources, int num_sources, float mul, float add, bool decay) {
+
+		ThreadPool& pool = thread_pool();
+		const glm::ivec3 dim = layout.dim;
+		const size_t group_size = layout.group_size();
+		const int per_group = layout.layers_per_group();
+		// whole groups of z layers that fit in the array:
+		const int groups = group_size ? int(std::min(num_voxels / group_size, size_t((std::max(dim.z, 0) + per_group - 1) / per_group))) : 0;
+		const int dimz = std::min(dim.z, groups * per_group);
+
+		// z slabs, a few per thread, but no thinner than one group of layers:
+		const int slabs = std::max(1, std::min(groups, pool.size() * 4));
+		slab_of_group.resize(groups);
+		for (int slab=0; slab<slabs; slab++) {
+			int g0, g1;
+			ThreadPool::band_range(slab, slabs, groups, g0, g1);
+			for (int g=g0; g<g1; g++) slab_of_group[g] = slab;
+		}
+
+		// split the sources into chunks of points:
+		chunks.clear();
+		size_t total_points = 0;
+		for (int s=0; s<num_sources; s++) {
+			const int n = sources[s].count;
+			const int bands = pool.bands_for(n, 4096);
+			for (int band=0; band<bands; band++) {
+				Chunk chunk;
+				chunk.source = s;
+				ThreadPool::band_range(band, bands, n, chunk.start, chunk.end);
+				chunk.first = total_points + chunk.start;
+				chunks.push_back(chunk);
+			}
+			total_points += n;
+		}
+		const int num_chunks = int(chunks.size());
+		targets.resize(total_points);
+		binned.resize(total_points);
+		histogram.assign(size_t(num_chunks) * slabs, 0);
+
+		// find the voxel of each point, and count the points per chunk & slab:
+		if (dimz > 0) pool.parallel_for(num_chunks, [&](int c) {
+			const Chunk& chunk = chunks[c];
+			const PointSource& src = sources[chunk.source];
+			uint32_t * counts = &histogram[size_t(c) * slabs];
+			uint32_t * out = &targets[chunk.first];
+			for (int idx=chunk.start; idx<chunk.end; idx++) {
+				// convert to voxel space:
+				const glm::vec4 v = mat * glm::vec4(src.vertices[src.indices[idx]], 1.f);
+				// compute index:
+				int x = v.x * dim.x;
+				int y = v.y * dim.y;
+				int z = v.z * dim.z;
+				uint32_t j = INVALID;
+				if (x >= 0 && x < dim.x && y >= 0 && y < dim.y && z >= 0 && z < dimz) {
+					j = uint32_t(layout.index(x, y, z));
+					counts[slab_of_group[z / per_group]]++;
+				}
+				*out++ = j;
+			}
+		});
+
+		// prefix sum, slab-major, so that each slab's points are contiguous:
+		slab_start.assign(slabs + 1, 0);
+		uint32_t offset = 0;
+		for (int slab=0; slab<slabs; slab++) {
+			slab_start[slab] = offset;
+			for (int c=0; c<num_chunks; c++) {
+				uint32_t& count = histogram[size_t(c) * slabs + slab];
+				const uint32_t n = count;
+				count = offset;	// becomes this chunk's write position within the slab
+				offset += n;
+			}
+		}
+		slab_start[slabs] = offset;
+
+		// bin the voxel indices by slab:
+		if (dimz > 0) pool.parallel_for(num_chunks, [&](int c) {
+			const Chunk& chunk = chunks[c];
+			uint32_t * pos = &histogram[size_t(c) * slabs];
+			const uint32_t * in = &targets[chunk.first];
+			for (int k=0, n=chunk.end-chunk.start; k<n; k++) {
+				const uint32_t j = in[k];
+				if (j != INVALID) binned[pos[slab_of_group[j / group_size]]++] = j;
+			}
+		});
+
+		// decay & splat each slab:
+		const typename Format::add_type amount = Format::make_add(add);
+		pool.parallel_for(slabs, [&](int slab) {
+			if (decay) {
+				int g0, g1;
+				ThreadPool::band_range(slab, slabs, groups, g0, g1);
+				size_t start = g0 * group_size;
+				size_t end = (slab == slabs-1) ? num_voxels : g1 * group_size;
+				Format::decay(voxels + start, end - start, mul);
+			}
+			for (uint32_t k=slab_start[slab]; k<slab_start[slab+1]; k++) {
+				Format::add(voxels[binned[k]], amount);
+			}
+		});
+
+		return offset;
+	}
+
+private:
+
+	static const uint32_t INVALID = 0xffffffff;
+
+	struct Chunk {
+		int source;
+		int start, end;	// range of the source's indices
+		size_t first;	// offset of the chunk in `targets`
+	};
+
+	std::vector<Chunk> chunks;
+	std::vector<int> slab_of_group;
+	std::vector<uint32_t> targets, binned, histogram, slab_start;
+};
+
+#endif // REALSENSE_VOXELS_H